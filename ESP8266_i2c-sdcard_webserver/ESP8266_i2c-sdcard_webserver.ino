@@ -3,6 +3,11 @@
 #include <Wire.h>
 uint32_t i2c_bus_Clock = 100000; // default is 100000 we will go with that for stability. 
 uint32_t i2c_bus_FileDownload = 400000; // used for browser download only, but can be set lower if there are I2C issues or noise
+uint32_t i2c_bus_List = 200000; // used for directory listings in the browser
+uint32_t i2c_bus_MaxClock = 1700000; // fastest clock the start-up probe tries for each of the three above
+bool i2c_bus_AutoClock = true; // probe the clocks at start-up, lower them on I2C errors and raise them again once quiet
+bool i2c_bus_CheckedReads = true; // CRC-checked file reads that retry bad chunks, if the bridge firmware supports them ('G')
+uint16_t i2c_bus_TraceRecords = 0; // keep the last N bridge transactions in RAM (20 bytes each) for /trace; 0 = off, /trace?start=N turns it on later
 /*
 i2c_Standard_Mode = 100000; // sd-card to browser about 3.5k/sec
 i2c_Fast_Mode = 400000; // sd-card to browser about 9k/sec
@@ -14,6 +19,20 @@ i2c_High_speed_mode_Hs = 1700000; // sd-card to browser about 15k/sec, might be
 const char* ssid = "YOUR_SSID";
 const char* password = "YOUR_PASSWORD";
 
+// Cache-Control sent with files from the SD card, by MIME type prefix (first match wins).
+// Every file also gets an ETag/Last-Modified, so "no-cache" costs the browser only a quick 304 round trip.
+struct CacheControlRule {
+  const char* typePrefix;
+  const char* cacheControl;
+};
+const CacheControlRule cacheControlRules[] = {
+  { "text/html", "no-cache" },
+  { "text/css", "max-age=86400" },
+  { "application/javascript", "max-age=86400" },
+  { "image/", "max-age=604800" },
+  { "", "no-cache" }  // everything else, including downloads
+};
+
 // Create a web server object that listens on port 80
 ESP8266WebServer server(80);
 #include "SDCardFunc.h"
@@ -23,7 +42,6 @@ void handleRoot() {
 }
 
 void handleWebRequests() {
-  if (SDCARDBUSY) return; // Check if the SD-Card is busy, if it is it will just return blank page
   if (loadFromI2CSD(server.uri())) { // if this fails, the below 404 page will be displayed
     return;
   }
@@ -97,15 +115,21 @@ void setup() {
   }
 
   // Start I2C
-  Wire.begin();
-  Wire.setClock(i2c_bus_Clock);
+  sdWire.begin();
+  sdWire.setClock(i2c_bus_Clock);
+  sdTraceBegin(i2c_bus_TraceRecords);
 
   // Check for I2C Card
-  Wire.beginTransmission(I2C_SDCARD);
-    byte error = Wire.endTransmission();
+  sdWire.beginTransmission(I2C_SDCARD);
+    byte error = sdWire.endTransmission();
     if (error == 0) {
       Detected_i2cSDCard = true;
       Serial.println("Found I2C SD-Card at address: " + String(I2C_SDCARD));
+      if (i2c_bus_AutoClock) sdClockProbe(); // pick the fastest clean clock for commands, listings and downloads
+      sdReplyPollProbe();
+      sdReadProbeChecked();
+      sdStatProbe();
+      sdDirSkipProbe();
       queryCardType();
       getvolsize();
       RunSDCard_Demo(); // Runs though most of the functions available
@@ -114,14 +138,44 @@ void setup() {
 
   
 
+  // Request headers the handlers look at (the server drops all others)
+  const char* headerKeys[] = { "Range", "If-Range", "If-None-Match", "If-Modified-Since", "Accept-Encoding" };
+  server.collectHeaders(headerKeys, sizeof(headerKeys) / sizeof(headerKeys[0]));
+
   // Define routes
-  server.onNotFound(handleWebRequests);  // If no route found, let's check the SD-Card for file per URI
+  // Handlers are wrapped by sdProfiled() so /profile can tell which requests hold up the loop
+  server.onNotFound(sdProfiled("*", handleWebRequests));  // If no route found, let's check the SD-Card for file per URI
   
-  server.on("/deleteFile", HTTP_POST, handleDeleteFile);
+  server.on("/deleteFile", HTTP_POST, sdProfiled("/deleteFile", handleDeleteFile));
+
+  server.on("/upload", HTTP_POST, sdProfiled("/upload", handleUploadDone), sdProfiled("/upload", handleUpload));  // multipart upload into ?DIR=, streamed to the card
+
+  server.on("/", sdProfiled("/", handleRoot));
+
+  server.on("/busStats", sdProfiled("/busStats", []() {
+      ChunkedResponse out;
+      out.begin(200, "text/plain");
+      sdBusPrintStats(out);
+      sdClockPrintStats(out);
+      sdReadPrintStats(out);
+      out.end();
+    }));
+
+  server.on("/metrics", sdProfiled("/metrics", handleMetrics));  // Prometheus text format
+
+  server.on("/trace", sdProfiled("/trace", handleTrace));  // recent bridge transactions: ?format=bin, ?start=N, ?stop=1
+
+  server.on("/profile", sdProfiled("/profile", []() {  // loop and handler times, longest stalls; ?reset=1 starts over afterwards
+      ChunkedResponse out;
+      out.begin(200, "text/plain");
+      sdProfilePrint(out);
+      out.end();
+      if (server.arg("reset") == "1") sdProfileReset();
+    }));
 
-  server.on("/", handleRoot);
+  server.on("/api/list", sdProfiled("/api/list", handleListApi));  // JSON: ?DIR=, ?offset=, ?limit=
 
-  server.on("/listSDCard", []() {
+  server.on("/listSDCard", sdProfiled("/listSDCard", []() {
       String argDIR = "/";
       if (server.arg("DIR") == "") {
         argDIR = "/";
@@ -138,8 +192,8 @@ void setup() {
         perPage = server.arg("perPage").toInt();
         if (perPage < 1) perPage = 20;
       }
-      server.send(200, "text/html", listDirectory_HTML(argDIR.c_str(), page, perPage));
-    });
+      listDirectory_HTML(argDIR.c_str(), page, perPage);
+    }));
 
     
 
@@ -156,7 +210,10 @@ void setup() {
 }
 
 void loop() {
+  SDProfileLoop profile; // times this iteration for /profile
   server.handleClient();
+  sdBusRun(); // give the bus to the next queued job (download slices)
+  SDFileWriter::pollAll(); // write out buffered log data that has waited long enough
   // put your main code here, to run repeatedly:
 
 }
@@ -0,0 +1,166 @@
+/*
+
+- SDBusOp A scope guard for bus work done directly inside a request handler (listing, stat, write, delete). While one exists the bus counts as busy; its count and the time it held the bus are added to sdBusStats under its kind.
+- sdBusBusy() Returns true while a handler operation or a queued job is using the bus.
+- sdBusEnqueue(uint8_t priority, uint8_t kind, std::function<bool()> step, const char* path) Queues deferred bus work: the slices of a download. step() does one bounded piece and returns true while there is more to do. path (optional, it must live as long as the job) names the file in the stall profiler.
+- sdBusRun() Called from loop(): runs one step of the most urgent queued job. SD_BUS_INTERACTIVE jobs go before SD_BUS_BULK ones, jobs of equal priority take turns, and a bulk job that has waited longer than sdBusMaxBulkWaitMs is served regardless.
+- sdBusQueued(uint8_t kind) Number of queued jobs of a kind.
+- sdBusOpSeq Counts SDBusOp scopes (nested ones too) and job steps. Code that leaves state on the bridge (such as a file being streamed) can compare it to tell whether anything else has used the bus since.
+- sdBusUntouchedSince(uint32_t seq) Returns true if nothing has used the bus since sdBusOpSeq was seq, apart from the start of the job step that is running now: a job that reads sdBusOpSeq at the end of one step still finds the bridge as it left it in its next step.
+- sdBusPrintStats(Print& out) Writes queue depth, wait times and per-kind operation counts as plain text.
+
+Only downloads are queued. Listings, stats, writes and deletes run inline in their handlers under an SDBusOp: the
+sketch is single threaded and the web server runs a handler between two loop() iterations, so that work already
+gets the bus between two job steps, ahead of every queued slice, and queueing it would only delay it. The two
+priorities order the downloads among themselves: a small file (a page's CSS or JS, up to sdBusInteractiveMaxBytes)
+is queued as interactive and is finished between the slices of a multi-megabyte log download, which is bulk,
+instead of waiting for it. Wait times are measured from the moment a job becomes ready (queued, or its previous
+step ended) until its next step starts.
+
+*/
+#include <vector>
+#include <functional>
+
+enum SDBusPriority : uint8_t { SD_BUS_INTERACTIVE = 0, SD_BUS_BULK = 1, SD_BUS_PRIORITIES = 2 };
+enum SDBusOpKind : uint8_t { SD_OP_LIST, SD_OP_STAT, SD_OP_READ, SD_OP_WRITE, SD_OP_DELETE, SD_OP_KINDS };
+const char* const sdBusOpNames[SD_OP_KINDS] = { "list", "stat", "read", "write", "delete" };
+
+uint32_t sdBusMaxBulkWaitMs = 2000;        // a bulk job waiting longer than this is served before interactive ones
+uint32_t sdBusInteractiveMaxBytes = 4096;  // downloads up to this size are queued as interactive
+
+struct SDBusStats {
+  uint32_t ops[SD_OP_KINDS] = {0};         // handler operations
+  uint32_t opUs[SD_OP_KINDS] = {0};        // time they held the bus
+  uint32_t jobs[SD_BUS_PRIORITIES] = {0};  // jobs queued
+  uint32_t steps[SD_BUS_PRIORITIES] = {0}; // job steps run
+  uint32_t waitUs[SD_BUS_PRIORITIES] = {0};    // total wait before steps
+  uint32_t maxWaitUs[SD_BUS_PRIORITIES] = {0}; // longest wait before a step
+  uint32_t aged = 0;                       // bulk steps run ahead of interactive ones because they waited too long
+  uint32_t rejected = 0;                   // downloads refused with 503 because SD_MAX_TRANSFERS were queued
+  uint16_t maxDepth = 0;                   // most jobs queued at once
+};
+
+struct SDBusJob {
+  uint8_t priority;
+  uint8_t kind;
+  uint32_t readySince;  // micros()
+  std::function<bool()> step;
+  const char* path;     // for SDProfileSection
+};
+
+std::vector<SDBusJob> sdBusQueue;
+SDBusStats sdBusStats;
+uint8_t sdBusDepth = 0;  // nesting of SDBusOp / running job steps
+uint32_t sdBusOpSeq = 0;
+uint32_t sdBusStepSeq = 0;  // sdBusOpSeq at the start of the running job step, 0 outside steps
+
+bool sdBusUntouchedSince(uint32_t seq) {
+  return sdBusOpSeq == seq || (sdBusStepSeq != 0 && sdBusOpSeq == sdBusStepSeq && sdBusStepSeq == seq + 1);
+}
+
+bool sdBusBusy() {
+  return sdBusDepth > 0;
+}
+
+class SDBusOp {
+  public:
+    explicit SDBusOp(uint8_t kind) : _kind(kind), _started(micros()), _outer(sdBusDepth == 0) {
+      sdBusOpSeq++;
+      sdBusDepth++;
+    }
+    ~SDBusOp() {
+      sdBusDepth--;
+      if (!_outer) return;  // nested operations are part of the outer one
+      sdBusStats.ops[_kind]++;
+      sdBusStats.opUs[_kind] += micros() - _started;
+    }
+
+  private:
+    uint8_t _kind;
+    uint32_t _started;
+    bool _outer;
+};
+
+void sdBusEnqueue(uint8_t priority, uint8_t kind, std::function<bool()> step, const char* path = nullptr) {
+  sdBusQueue.push_back({ priority, kind, (uint32_t)micros(), std::move(step), path });
+  sdBusStats.jobs[priority]++;
+  if (sdBusQueue.size() > sdBusStats.maxDepth) sdBusStats.maxDepth = sdBusQueue.size();
+}
+
+size_t sdBusQueued(uint8_t kind) {
+  size_t n = 0;
+  for (const auto& job : sdBusQueue) {
+    if (job.kind == kind) n++;
+  }
+  return n;
+}
+
+void sdBusRun() {
+  if (sdBusQueue.empty() || sdBusBusy()) return;
+  uint32_t now = micros();
+  size_t pick = 0;
+  uint8_t pickPriority = SD_BUS_PRIORITIES;
+  bool pickAged = false;
+  for (size_t i = 0; i < sdBusQueue.size(); i++) {
+    const SDBusJob& job = sdBusQueue[i];
+    bool aged = job.priority > SD_BUS_INTERACTIVE && now - job.readySince > sdBusMaxBulkWaitMs * 1000;
+    uint8_t priority = aged ? (uint8_t)SD_BUS_INTERACTIVE : job.priority;
+    // Most urgent first; among equals the one that has been ready longest, so they take turns
+    if (priority < pickPriority || (priority == pickPriority && now - job.readySince > now - sdBusQueue[pick].readySince)) {
+      pick = i;
+      pickPriority = priority;
+      pickAged = aged;
+    }
+  }
+
+  SDBusJob& job = sdBusQueue[pick];
+  uint32_t waited = now - job.readySince;
+  sdBusStats.steps[job.priority]++;
+  sdBusStats.waitUs[job.priority] += waited;
+  if (waited > sdBusStats.maxWaitUs[job.priority]) sdBusStats.maxWaitUs[job.priority] = waited;
+  if (pickAged) sdBusStats.aged++;
+
+  std::function<bool()> step = job.step;  // the queue may grow while it runs
+  SDProfileSection section("job", sdBusOpNames[job.kind], job.path);
+  sdBusStepSeq = ++sdBusOpSeq;
+  sdBusDepth++;
+  bool more = step();
+  sdBusDepth--;
+  sdBusStepSeq = 0;
+  if (more) {
+    sdBusQueue[pick].readySince = micros();
+  } else {
+    sdBusQueue.erase(sdBusQueue.begin() + pick);
+  }
+}
+
+void sdBusPrintStats(Print& out) {
+  static const char* const priorityNames[SD_BUS_PRIORITIES] = { "interactive", "bulk" };
+  out.print(F("queue_depth "));
+  out.println(sdBusQueue.size());
+  out.print(F("queue_depth_max "));
+  out.println(sdBusStats.maxDepth);
+  out.print(F("rejected "));
+  out.println(sdBusStats.rejected);
+  out.print(F("aged_bulk_steps "));
+  out.println(sdBusStats.aged);
+  for (uint8_t p = 0; p < SD_BUS_PRIORITIES; p++) {
+    out.print(priorityNames[p]);
+    out.print(F(" jobs "));
+    out.print(sdBusStats.jobs[p]);
+    out.print(F(" steps "));
+    out.print(sdBusStats.steps[p]);
+    out.print(F(" wait_avg_ms "));
+    out.print(sdBusStats.steps[p] ? sdBusStats.waitUs[p] / sdBusStats.steps[p] / 1000.0 : 0.0, 1);
+    out.print(F(" wait_max_ms "));
+    out.println(sdBusStats.maxWaitUs[p] / 1000.0, 1);
+  }
+  for (uint8_t k = 0; k < SD_OP_KINDS; k++) {
+    out.print(F("op "));
+    out.print(sdBusOpNames[k]);
+    out.print(F(" count "));
+    out.print(sdBusStats.ops[k]);
+    out.print(F(" bus_ms "));
+    out.println(sdBusStats.opUs[k] / 1000);
+  }
+}
@@ -3,10 +3,14 @@
 - getFileNamesFromSD() Returns the global std::vector<std::pair<String, uint32_t>> fileNames containing file names and sizes previously retrieved from the SD card.
 - getDirectoryNamesFromSD() Returns the global std::vector<String> directoryNames containing directory names previously retrieved from the SD card.
 - CustDelay(uint16_t mils) Pauses execution for mils milliseconds while allowing background tasks (like WiFi) to run using yield() . No return value.
+- sdWaitReady(uint32_t timeoutMs) Polls the I2C SD card module with address-only transactions until it ACKs again (it NACKs its address while the card is busy, e.g. committing a write), yielding in between. Returns false if it is still busy after timeoutMs.
+- sdWaitReply() Waits between a command sent without STOP ('S', 'X', 'M', 'D') and the requestFrom() that reads its reply: with sdWaitReady() if sdReplyPollProbe() found that the bridge keeps the pending reply across its address probes, else with the fixed CustDelay(5).
+- sdReplyPollProbe() Called from setup(): sends 'K' for the root directory and reads the reply once after CustDelay(5) and once after sdWaitReady(); turns on polling in sdWaitReply() if both read 1.
+- sdWriteChunk(char command, const uint8_t* data, size_t len) Sends one 'W'/'A' transaction, re-sending it while the bridge NACKs its address because the card is still committing the previous chunk. Returns Wire's error code, 2 if the bridge was still busy after SD_READY_TIMEOUT_MS.
 - setSDCardTime(uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute, uint8_t second) Sends the specified date and time components to the I2C SD card module using the 'C' command to set its internal clock. Prints status/errors to Serial. No return value.
-- sendFilename(const char* filename) Helper function to send a filename to the I2C SD card module using the 'F' command. Returns true on success, false on I2C error.
-- storetoSD(const char* filename, char command, const char* msg) Writes ( command='W' ) or appends ( command='A' ) the string msg to the specified filename on the I2C SD card. Handles sending the filename ('F' command) and then the data in chunks, ensuring subsequent chunks always use append ('A'). Prints errors to Serial. No return value.
-- ReadFromSD(const char* filename) Reads the entire content of the specified filename from the I2C SD card and prints it to the Serial monitor. It first gets the file size ('S' command) and then reads the data ('R' command) in chunks. Prints status/errors to Serial. No return value.
+- sendFilename(const char* filename) Helper function to send a filename to the I2C SD card module using the 'F' command. Skips the transaction if sdSelectedPath says the bridge already has filename selected. Returns true on success, false on I2C error.
+- storetoSD(const char* filename, char command, const char* msg) Writes ( command='W' ) or appends ( command='A' ) the string msg to the specified filename on the I2C SD card. Handles sending the filename ('F' command) and then the data in chunks, ensuring subsequent chunks always use append ('A'). Prints errors to Serial. No return value. For many small writes to one file, or data containing NUL bytes, use an SDFileWriter (SDFileWriter.h).
+- ReadFromSD(const char* filename) Reads the entire content of the specified filename from the I2C SD card and prints it to the Serial monitor, through an SDFileReader (size with 'S', then the data in chunks, CRC-checked with 'G' or plain 'R'). Prints status/errors to Serial. No return value.
 - GetFileSize(const char* filename) Gets the size of the specified filename on the I2C SD card using the 'F' (filename) and 'S' (size) commands. Returns the file size as an int (uint32_t internally), or -1 on I2C error.
 - checkExists(const char* path, bool isDirectory) Checks if a given path exists on the I2C SD card. Uses command 'E' if isDirectory is false (checking for a file) or 'K' if isDirectory is true (checking for a directory), after sending the path with 'F'. Returns true if the path exists as the specified type, false otherwise or on error. Prints status/errors to Serial.
 - removeFile(const char* filename) Deletes the specified filename from the I2C SD card using the 'F' (filename) and 'X' (remove file) commands. Returns true on success, false on failure or I2C error. Prints status/errors to Serial.
@@ -16,7 +20,17 @@
 - getvolsize() Queries the I2C SD card module for volume information (such as total size and free space) and typically prints this information to the Serial monitor. No parameters required. Used to inspect the storage capacity and available space on the SD card.
 - dirListFromSD(const char* dirname) Sends a command ('L') to the I2C SD card module to list the contents of the specified directory dirname . It reads the response, parses filenames and sizes, populates the global fileNames (vector of pairs) and directoryNames (vector of strings) with the results, and prints the formatted directory listing to the Serial monitor. No return value. Used to inspect the contents of a directory on the SD card.
 - listDirectory(const char* dirname) Sends a command ('L') to the I2C SD card module to list the contents of the specified directory dirname . It reads the response, parses filenames and sizes, populates the global fileNames (vector of pairs) and directoryNames (vector of strings) with the results, and prints the formatted directory listing to the Serial monitor. No return value. Used to inspect the contents of a directory on the SD card.
-- listDirectory_HTML(const char* dirname) Reads the contents (files and subdirectories) of the specified directory dirname on the I2C SD card and returns an HTML formatted String representing the directory listing. Used for displaying directory contents in a web interface.
+- parseRangeHeader(uint32_t size, uint32_t modified, uint32_t& offset, uint32_t& length) Reads the request's Range header (a single "bytes=" range) for a file of size bytes, honoured only if an If-Range header matches the file's ETag or Last-Modified (from size and modified). Returns the status to answer with: 200 (whole file), 206 (offset/length set to the requested part) or 416 (range past the end of the file).
+- acceptsGzip() Returns true if the request's Accept-Encoding header allows gzip.
+- sendNotModified(const String& dataType, uint32_t size, uint32_t modified, bool gzip) Checks the request's If-None-Match / If-Modified-Since against the file's ETag (size + modification time) and Last-Modified. Sends a 304 and returns true if the client's copy is still current.
+- sendFileHeaders(int status, const String& dataType, uint32_t size, uint32_t modified, bool gzip, uint32_t offset, uint32_t length) Sends the status line and headers of a file response: Accept-Ranges, Content-Range, ETag, Last-Modified, the Cache-Control of cacheControlRules and, for a pre-compressed sibling, Content-Encoding/Vary. For 416 it sends the complete error response.
+- handleUpload() Upload handler of the POST /upload?DIR=... route: writes each piece of a multipart file upload to DIR on the I2C SD card as it arrives, through an unbuffered SDFileWriter ('W' for the first 31 bytes, 'A' after that), printing progress to Serial. Memory use does not depend on the file size and binary data is written unchanged.
+- handleUploadDone() Route handler of POST /upload, called once the body has been received: answers 200 with the path, size and write rate, or 500 with the reason the upload failed.
+- CustDelay() and sdWaitReady() add the time they spin to sdProfileSpinUs (SDProfiler.h), reported by /profile.
+- handleListApi() Route handler of GET /api/list?DIR=...&offset=&limit=: entries offset to offset + limit - 1 (limit defaults to SD_API_LIST_LIMIT, at most SD_API_LIST_LIMIT_MAX) of DIR as a compact JSON array of {"type":"file"|"dir","name","size","mtime"}, written to the socket as the entries come off the listing cursor (SDDirCursor.h) or out of the listing cache. mtime is always null: 'L' records carry no timestamp, and a 'T' per entry would cost a round trip each and end the listing stream. A client has read the whole directory when a response holds fewer than limit entries. Names are JSON-escaped (control characters as \u00XX) and bytes that are not UTF-8 are sent as U+FFFD.
+- handleTrace() Route handler of GET /trace: the SDTrace.h transaction ring as text, or binary with ?format=bin (for host_sim/trace_replay). ?start=N starts a new trace of N records (at most SD_TRACE_MAX_RECORDS; anything but a number is answered with 400), ?stop=1 stops tracing and frees the ring.
+- handleMetrics() Route handler of GET /metrics: the SDMetrics.h counters and latency histograms plus the bus, clock, read, cache, card and heap figures in Prometheus text format, streamed with ChunkedResponse.
+- listDirectory_HTML(const char* dirname, int page, int perPage) Reads the contents (files and subdirectories) of the specified directory dirname on the I2C SD card and streams an HTML page with the requested page of the listing to the current web client (chunked transfer). Used for displaying directory contents in a web interface. There is no limit on the size of the directory: a page is read through the listing cursor (SDDirCursor.h), so it only costs its own entries on the bus, and "Page N of M" is shown once the end of the directory has been seen (from the listing cache or on the last page).
 
 */
 
@@ -24,13 +38,26 @@
 #include <vector>     // Include the vector library
 #include <WString.h>  // Include for Arduino String class
 #include <utility>    // Include for std::pair
+#include <memory>     // Include for std::shared_ptr
 #define I2C_SDCARD 0x6e
-bool SDCARDBUSY = false;
 bool Detected_i2cSDCard = false;
 uint8_t i2cSDCarderrcnt = 0;
 // Global dynamic arrays for filenames (with size) and directory names
 std::vector<std::pair<String, uint32_t>> fileNames;  // Store pairs of <filename, size>
 std::vector<String> directoryNames;
+// Path the bridge has selected ('F' or 'I'), so sendFilename() can skip sending it again. Empty when unknown:
+// cleared by any I2C error (sdClockError(), directly or through sdI2CError()), since a bridge that NACKed may have
+// reset or missed the command.
+String sdSelectedPath;
+#include "SDTrace.h"      // sdWire: Wire with an optional ring buffer of recent bridge transactions for /trace
+#include "SDFileCache.h"  // RAM cache of small hot files served by loadFromI2CSD()
+#include "SDDirCache.h"   // RAM cache of parsed directory listings used by listDirectory_HTML()
+#include "SDDirStream.h"  // buffered reader for the 'L' listing stream
+#include "SDProfiler.h"   // loop() iteration times, handler times and the longest stalls for /profile
+#include "SDBus.h"        // bus scheduler: handler operations and queued download slices
+#include "SDMetrics.h"    // per-operation counters and latency histograms for /metrics
+#include "SDClock.h"      // per-operation I2C clocks, probed at boot and lowered on errors
+#include "SDChunkReader.h" // file reads in chunks, CRC-checked and retried when the bridge supports it
 
 // Functions to access the stored names (optional)
 std::vector<std::pair<String, uint32_t>> getFileNamesFromSD() {
@@ -42,52 +69,135 @@ std::vector<String> getDirectoryNamesFromSD() {
 }
 
 void CustDelay(uint16_t mils){
+  SDProfileSpin spin;
   unsigned long start = millis();
       while( millis() - start < mils){ // Pauses without impacting other cpu functions like WiFi
        yield();
      }
 }
 
+#define SD_READY_TIMEOUT_MS 250  // longest an SD card may take to commit a block
+
+// Waits only as long as the bridge actually needs, instead of a fixed CustDelay()
+bool sdWaitReady(uint32_t timeoutMs = SD_READY_TIMEOUT_MS) {
+  SDProfileSpin spin;
+  unsigned long start = millis();
+  while (true) {
+    sdWire.beginTransmission(I2C_SDCARD);
+    if (sdWire.endTransmission() == 0) return true;
+    if (millis() - start >= timeoutMs) return false;
+    yield();
+  }
+}
+
+// Sends one write transaction (command plus up to 31 bytes of data). The bridge NACKs its address until the card has
+// committed the previous chunk, so the chunk itself polls for readiness: it is re-sent, yielding in between, until the
+// bridge takes it or SD_READY_TIMEOUT_MS has passed. Returns Wire's error code (2 if it was still NACKed then).
+uint8_t sdWriteChunk(char command, const uint8_t* data, size_t len) {
+  unsigned long start = millis();
+  while (true) {
+    sdWire.beginTransmission(I2C_SDCARD);
+    sdWire.write(command);
+    sdWire.write(data, len);
+    uint8_t error = sdWire.endTransmission();
+    if (error != 2 || millis() - start >= SD_READY_TIMEOUT_MS) return error;
+    yield();
+  }
+}
+
 // --- Function to Set Time on SD Card Module ---
 void setSDCardTime(uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute, uint8_t second) {
   Serial.print("Sending time to SD Card Module: ");
   Serial.printf("%04d-%02d-%02d %02d:%02d:%02d\n", year, month, day, hour, minute, second);
 
-  Wire.beginTransmission(I2C_SDCARD);
-  Wire.write('C');  // Clock Set command
-  Wire.write((uint8_t)(year % 100));  // Send YY (e.g., 25 for 2025)
-  Wire.write(month);
-  Wire.write(day);
-  Wire.write(hour);
-  Wire.write(minute);
-  Wire.write(second);
+  sdWire.beginTransmission(I2C_SDCARD);
+  sdWire.write('C');  // Clock Set command
+  sdWire.write((uint8_t)(year % 100));  // Send YY (e.g., 25 for 2025)
+  sdWire.write(month);
+  sdWire.write(day);
+  sdWire.write(hour);
+  sdWire.write(minute);
+  sdWire.write(second);
 
-  uint8_t error = Wire.endTransmission();  // Send STOP
+  uint8_t error = sdWire.endTransmission();  // Send STOP
 
   if (error == 0) {
     Serial.println("Time sent successfully.");
   } else {
     Serial.print("Error sending time: I2C Error ");
     Serial.println(error);
+    sdClockError();
   }
 }
 
+// Fails metric with an I2C error (a Wire error code or SD_ERR_*) and reports it to sdClockError(), which also
+// forgets sdSelectedPath. Every failed transaction with the bridge goes through here or calls sdClockError() itself.
+void sdI2CError(SDMetric& metric, uint8_t error) {
+  metric.fail(error);
+  sdClockError();
+}
+
 // --- Helper Function to Send Filename ---
 bool sendFilename(const char* filename) {
-  Wire.beginTransmission(I2C_SDCARD);
-  Wire.write('F'); // Filename command
-  Wire.write(filename);
-  uint8_t error = Wire.endTransmission(true); // Send STOP after filename
+  if (sdSelectedPath.length() > 0 && sdSelectedPath == filename) {  // already selected
+    sdMetricsSelectSkipped++;
+    return true;
+  }
+  SDMetric metric(SD_METRIC_SELECT);
+  sdWire.beginTransmission(I2C_SDCARD);
+  sdWire.write('F'); // Filename command
+  sdWire.write(filename);
+  uint8_t error = sdWire.endTransmission(true); // Send STOP after filename
   if (error != 0) {
+    sdI2CError(metric, error);
     Serial.print("  [Error] Failed to send filename '"); Serial.print(filename);
     Serial.print("'. I2C Error: "); Serial.println(error);
     return false;
   }
+  sdSelectedPath = filename;
+  metric.bytes(strlen(filename));
   // Serial.print("  Filename '"); Serial.print(filename); Serial.println("' sent.");
  // delay(5); // Short delay for bridge processing
   return true;
 }
 
+// sdWaitReady() probes with a START, the address and a STOP in the middle of the command's transaction. That relies
+// on the bridge NACKing its address while it works on the command and keeping the reply for the requestFrom() after
+// the STOP; bridge firmware that drops the reply at the STOP keeps the original fixed wait.
+bool sdReplyPoll = false;  // set by sdReplyPollProbe()
+
+void sdWaitReply() {
+  if (sdReplyPoll) sdWaitReady();
+  else CustDelay(5);
+}
+
+void sdReplyPollProbe() {
+  SDBusOp busOp(SD_OP_STAT);
+  uint8_t reply[2] = { 0, 0 };
+  for (int i = 0; i < 2; i++) {
+    sdReplyPoll = i == 1;  // first the fixed wait, for the reference answer
+    if (!sendFilename("/")) break;
+    sdWire.beginTransmission(I2C_SDCARD);
+    sdWire.write('K');
+    uint8_t error = sdWire.endTransmission(false);  // Keep connection active for requestFrom
+    if (error == 0) {
+      sdWaitReply();
+      if (sdWire.requestFrom(I2C_SDCARD, 1, 1) == 1) reply[i] = sdWire.read();  // 0xFF if the reply was dropped
+    }
+    while (sdWire.available()) sdWire.read();
+    if (error != 0) {
+      sdClockError();
+      break;
+    }
+  }
+  sdReplyPoll = reply[0] == 1 && reply[1] == 1;
+  Serial.println(sdReplyPoll ? "Polling the bridge for replies enabled" : "Bridge drops a reply on an address probe (or did not answer 'K'), waiting 5 ms for replies");
+}
+
+
+#include "SDFileWriter.h"  // buffered 'W'/'A' writer; needs sendFilename() and sdWaitReady()
+#include "SDFileReader.h"  // Stream over a file on the card; needs sendFilename()
+#include "SDDirCursor.h"   // resumable listing cursor for paging through directories; needs sendFilename() and sdQuery()
 
 void storetoSD(const char* filename, char command, const char* msg) {
   /* Command  Name  Description
@@ -95,206 +205,84 @@ void storetoSD(const char* filename, char command, const char* msg) {
      'W'  Write data  Writes data to the file, overwriting if necessary.
      'A'  Append data Appends data to the end of the file, if it already exists.
   */
-
-  // Send filename first
-  Wire.beginTransmission(I2C_SDCARD);
-  Wire.write('F');
-  if (strlen(filename) < 31){
-    Serial.print("File name: ");
-    Serial.println(filename);
-  Wire.write(filename, strlen(filename)); // Sends the entire string content (excluding the null terminator) in potentially a more optimized way.
-  } else {
-    Serial.print("File name: ");
-    Serial.println(filename);
-  while (*filename) Wire.write(*filename++); // Sends the filename one character at a time, stopping just before the null terminator.
-  }
-  uint8_t error = Wire.endTransmission();  // Send STOP after filename
-  if (error != 0) {
-    Serial.print("I2C Error sending filename for storetoSD: ");
-    Serial.println(error);
-    return;
-  }
-  CustDelay(5);  // Small CustDelay after sending filename
+  SDBusOp busOp(SD_OP_WRITE);
+  Serial.print("File name: ");
+  Serial.println(filename);
 
   // Calculate message length
   const size_t msgLen = strlen(msg);
   if (msgLen == 0) {
     Serial.println("Warning: storetoSD called with empty message.");
-    // If command is 'W', we might want to explicitly truncate the file here.
-    // This requires a separate command on the ATtiny or handling 0-length write.
-    // For now, just return.
     return;
   }
 
-  const size_t bufferSize = 31;  // Max I2C buffer size - 1 for command byte
-  size_t offset = 0;
-
-  // --- Strategy: Send first chunk with original command, subsequent chunks with 'A' ---
-
-  // Send first chunk
-  Wire.beginTransmission(I2C_SDCARD);
-  Wire.write(command);  // Use the initial command ('W' or 'A')
-  size_t bytesToWrite = min(bufferSize, msgLen - offset);
-  Wire.write(msg + offset, bytesToWrite);
-  error = Wire.endTransmission(true);  // Send STOP
-  if (error != 0) {
-    Serial.print("I2C Error during first write chunk: ");
-    Serial.println(error);
-    return;
-  }
-  offset += bytesToWrite;
- CustDelay(5);
-
-  // Send subsequent chunks (if any) ALWAYS using 'A' (append)
-  while (offset < msgLen) {
-    Wire.beginTransmission(I2C_SDCARD);
-    Wire.write('A');  // <<< ALWAYS use Append for subsequent chunks
-    bytesToWrite = min(bufferSize, msgLen - offset);
-    Wire.write(msg + offset, bytesToWrite);
-    error = Wire.endTransmission(true);  // Send STOP
-    if (error != 0) {
-      Serial.print("I2C Error during subsequent append chunk: ");
-      Serial.println(error);
-      return;
-    }
-    offset += bytesToWrite;
-   CustDelay(5);
-  }
+  // Unbuffered: the first chunk goes with the original command, the rest with 'A'. Code that writes many
+  // small pieces to one file should keep an SDFileWriter open instead of calling this for each of them.
+  SDFileWriter file;
+  file.open(filename, command == 'A', 0);
+  file.write((const uint8_t*)msg, msgLen);
+  file.close();
 }
 
 void ReadFromSD(const char* filename) {
-  // Send Filename
-  Wire.beginTransmission(I2C_SDCARD);
-  Wire.write('F');
-  if (strlen(filename) < 31){
-    Serial.print("File name: ");
-    Serial.println(filename);
-  Wire.write(filename, strlen(filename)); // Sends the entire string content (excluding the null terminator) in potentially a more optimized way.
-  } else {
-    Serial.print("File name: ");
-    Serial.println(filename);
-  while (*filename) Wire.write(*filename++); // Sends the filename one character at a time, stopping just before the null terminator.
-  }
-  uint8_t error = Wire.endTransmission();  // Send STOP
-  if (error != 0) {
-    Serial.print("I2C Error sending filename for read: ");
-    Serial.println(error);
-    return;
-  }
-  CustDelay(5);
-
-  // Get File Size
-  Wire.beginTransmission(I2C_SDCARD);
-  Wire.write('S');
-  error = Wire.endTransmission(false);  // Keep connection active for requestFrom
-  if (error != 0) {
-    Serial.print("I2C Error sending 'S' command: ");
-    Serial.println(error);
-    return;
-  }
- CustDelay(5);
-
-  uint32_t size = 0;
-  uint8_t bytesRead = Wire.requestFrom(I2C_SDCARD, 4, 1);  // Request 4 bytes, send STOP
-  if (bytesRead == 4) {
-    for (int i = 0; i < 4; i++) size = (size << 8) | Wire.read();
-  } else {
-    Serial.print("Error reading size, expected 4 bytes, got ");
-    Serial.println(bytesRead);
-    // Consume any remaining bytes if necessary
-    while (Wire.available()) Wire.read();
-    return;
-  }
+  SDBusOp busOp(SD_OP_READ);
+  Serial.print("File name: ");
+  Serial.println(filename);
+  SDFileReader file;
+  if (!file.open(filename)) return;
 
   Serial.print("File Size: ");
-  Serial.println(size);
+  Serial.println(file.size());
 
-  if (size == 0) {
+  if (file.size() == 0) {
     Serial.println("File is empty or not found.");
     return;
   }
 
   Serial.println("--- File Start ---");
 
-  // Send Read Command
-  Wire.beginTransmission(I2C_SDCARD);
-  Wire.write('R');
-  error = Wire.endTransmission(false);  // Keep connection active for requestFrom
-  if (error != 0) {
-    Serial.print("I2C Error sending 'R' command: ");
-    Serial.println(error);
-    return;
-  }
- CustDelay(5);
-
   // Read data in chunks
-  const int readChunkSize = 32;
-  uint32_t bytesRemaining = size;
-
-  while (bytesRemaining > 0) {
-    int bytesToRequest = min((int)bytesRemaining, readChunkSize);
-    bytesRead = Wire.requestFrom(I2C_SDCARD, bytesToRequest, 0);  // Don't send STOP yet
-
-    if (bytesRead > 0) {
-      for (int i = 0; i < bytesRead; i++) {
-        if (Wire.available()) {
-          Serial.print((char)Wire.read());
-        } else {
-          Serial.println("\nError: Wire not available during read chunk.");
-          Wire.endTransmission();  // Send STOP on error
-          return;
-        }
-      }
-      bytesRemaining -= bytesRead;
-    } else {
-      Serial.print("\nError reading file chunk, expected ");
-      Serial.print(bytesToRequest);
-      Serial.println(" bytes, got 0.");
-      Wire.endTransmission();  // Send STOP on error
-      return;
-    }
-    CustDelay(1);  // Small CustDelay between read requests
+  uint8_t chunk[SD_READ_CHUNK_MAX];
+  while (file.available() > 0) {
+    int got = file.read(chunk, sizeof(chunk));
+    if (got <= 0) return;  // the reader has printed the offset
+    Serial.write(chunk, got);
   }
-
-  Wire.endTransmission();  // Send STOP after the last chunk is read
   Serial.println("\r\n--- File END ---");
 }
 
 
 int GetFileSize(const char* filename) {
+  SDBusOp busOp(SD_OP_STAT);
   const char* fname = filename;  // Keep original pointer for printing
-  // Send Filename
-  Wire.beginTransmission(I2C_SDCARD);
-  Wire.write('F');
-  Wire.write(filename, strlen(filename));
-  uint8_t error = Wire.endTransmission();  // Send STOP
-  if (error != 0) {
-    Serial.print("I2C Error sending filename for GetFileSize: ");
-    Serial.println(error);
+  SDMetric metric(SD_METRIC_STAT);
+  if (!sendFilename(filename)) {
+    metric.fail();
     return -1;  // Indicate error
   }
- CustDelay(5);
 
   // Send Size Command
-  Wire.beginTransmission(I2C_SDCARD);
-  Wire.write('S');
-  error = Wire.endTransmission(false);  // Keep connection active for requestFrom
+  sdWire.beginTransmission(I2C_SDCARD);
+  sdWire.write('S');
+  uint8_t error = sdWire.endTransmission(false);  // Keep connection active for requestFrom
   if (error != 0) {
+    sdI2CError(metric, error);
     Serial.print("I2C Error sending 'S' command for GetFileSize: ");
     Serial.println(error);
     return -1;
   }
- CustDelay(5);
+  sdWaitReply();
 
   // Request Size
   uint32_t size = 0;
-  uint8_t bytesRead = Wire.requestFrom(I2C_SDCARD, 4, 1);  // Request 4 bytes, send STOP
+  uint8_t bytesRead = sdWire.requestFrom(I2C_SDCARD, 4, 1);  // Request 4 bytes, send STOP
   if (bytesRead == 4) {
-    for (int i = 0; i < 4; i++) size = (size << 8) | Wire.read();
+    for (int i = 0; i < 4; i++) size = (size << 8) | sdWire.read();
   } else {
+    sdI2CError(metric, SD_ERR_SHORT_READ);
     Serial.print("Error reading size for GetFileSize, expected 4 bytes, got ");
     Serial.println(bytesRead);
-    while (Wire.available()) Wire.read();  // Consume any remaining bytes
+    while (sdWire.available()) sdWire.read();  // Consume any remaining bytes
     return -1;                             // Indicate error
   }
 
@@ -304,75 +292,81 @@ int GetFileSize(const char* filename) {
 
 // --- Function to Check if Path Exists ('E' for files, 'K' for directories) ---
 bool checkExists(const char* path, bool isDirectory) {
+  SDBusOp busOp(SD_OP_STAT);
   Serial.print("--- Checking if "); Serial.print(isDirectory ? "Directory" : "File");
   Serial.print(" '"); Serial.print(path); Serial.print("' exists ('");
   Serial.print(isDirectory ? 'K' : 'E'); Serial.println("') ---");
 
-  if (!sendFilename(path)) return false; // Send filename first
+  SDMetric metric(SD_METRIC_STAT);
+  if (!sendFilename(path)) { // Send filename first
+    metric.fail();
+    return false;
+  }
 
-  Wire.beginTransmission(I2C_SDCARD);
-  Wire.write(isDirectory ? 'K' : 'E'); // Send appropriate command
-  uint8_t error = Wire.endTransmission(false); // Send command, NO STOP
+  sdWire.beginTransmission(I2C_SDCARD);
+  sdWire.write(isDirectory ? 'K' : 'E'); // Send appropriate command
+  uint8_t error = sdWire.endTransmission(false); // Send command, NO STOP
   if (error != 0) {
+    sdI2CError(metric, error);
     Serial.print("  [Error] Failed to send check command. I2C Error: "); Serial.println(error);
-    Wire.endTransmission();
+    sdWire.endTransmission();
     return false; // Indicate uncertainty
   }
 
-  uint8_t bytesReceived = Wire.requestFrom(I2C_SDCARD, 1, 1); // Request 1 byte, send STOP
+  uint8_t bytesReceived = sdWire.requestFrom(I2C_SDCARD, 1, 1); // Request 1 byte, send STOP
   if (bytesReceived == 1) {
-    uint8_t result = Wire.read();
+    uint8_t result = sdWire.read();
     Serial.print("  Result: "); Serial.print(result);
     if (result == 1) {
       Serial.println(" (Exists)");
-      Wire.endTransmission();
+      sdWire.endTransmission();
       return true;
     } else {
       Serial.println(" (Does Not Exist or Not a Dir)");
-      Wire.endTransmission();
+      sdWire.endTransmission();
       return false;
     }
   } else {
-    Wire.endTransmission();
+    sdI2CError(metric, SD_ERR_SHORT_READ);
+    sdWire.endTransmission();
     Serial.println("  [Error] Did not receive expected byte for existence check.");
     return false; // Indicate uncertainty
   }
 }
 
 bool removeFile(const char* filename) {
+  SDBusOp busOp(SD_OP_DELETE);
   const char* fname = filename;  // Keep original pointer for printing
-  // Send Filename
-  Wire.beginTransmission(I2C_SDCARD);
-  Wire.write('F');
-  Wire.write(filename, strlen(filename));
-  uint8_t error = Wire.endTransmission();  // Send STOP
-  if (error != 0) {
-    Serial.print("I2C Error sending filename for removeFile: ");
-    Serial.println(error);
+  sdFileCacheInvalidate(filename);
+  sdDirCacheInvalidate(filename);
+  SDMetric metric(SD_METRIC_DELETE);
+  if (!sendFilename(filename)) {
+    metric.fail();
     return false;
   }
- CustDelay(5);
 
   // Send Remove File Command
-  Wire.beginTransmission(I2C_SDCARD);
-  Wire.write('X');                      // 'X' for remove file
-  error = Wire.endTransmission(false);  // Keep connection active for requestFrom
+  sdWire.beginTransmission(I2C_SDCARD);
+  sdWire.write('X');                      // 'X' for remove file
+  uint8_t error = sdWire.endTransmission(false);  // Keep connection active for requestFrom
   if (error != 0) {
+    sdI2CError(metric, error);
     Serial.print("I2C Error sending 'X' command: ");
     Serial.println(error);
     return false;
   }
-  CustDelay(5);
+  sdWaitReply();
 
   // Request Result (1 byte: 1 for success, 0 for failure)
   bool success = false;
-  uint8_t bytesRead = Wire.requestFrom(I2C_SDCARD, 1, 1);  // Request 1 byte, send STOP
+  uint8_t bytesRead = sdWire.requestFrom(I2C_SDCARD, 1, 1);  // Request 1 byte, send STOP
   if (bytesRead == 1) {
-    success = (Wire.read() == 1);
+    success = (sdWire.read() == 1);
   } else {
+    sdI2CError(metric, SD_ERR_SHORT_READ);
     Serial.print("Error reading removeFile status, expected 1 byte, got ");
     Serial.println(bytesRead);
-    while (Wire.available()) Wire.read();  // Consume any remaining bytes
+    while (sdWire.available()) sdWire.read();  // Consume any remaining bytes
     return false;                          // Assume failure on error
   }
 
@@ -388,39 +382,37 @@ bool removeFile(const char* filename) {
 }
 
 bool mkdir(const char* dirname) {
+  SDBusOp busOp(SD_OP_WRITE);
   const char* dname = dirname;  // Keep original pointer for printing
-  // Send Directory Name (using 'F' command)
-  Wire.beginTransmission(I2C_SDCARD);
-  Wire.write('F');
-  Wire.write(dirname, strlen(dirname));
-  uint8_t error = Wire.endTransmission();  // Send STOP
-  if (error != 0) {
-    Serial.print("I2C Error sending dirname for mkdir: ");
-    Serial.println(error);
+  sdDirCacheInvalidate(dirname);
+  SDMetric metric(SD_METRIC_WRITE);
+  if (!sendFilename(dirname)) {  // Send Directory Name (using 'F' command)
+    metric.fail();
     return false;
   }
-  CustDelay(5);
 
   // Send Make Directory Command
-  Wire.beginTransmission(I2C_SDCARD);
-  Wire.write('M');                      // 'M' for make directory
-  error = Wire.endTransmission(false);  // Keep connection active for requestFrom
+  sdWire.beginTransmission(I2C_SDCARD);
+  sdWire.write('M');                      // 'M' for make directory
+  uint8_t error = sdWire.endTransmission(false);  // Keep connection active for requestFrom
   if (error != 0) {
+    sdI2CError(metric, error);
     Serial.print("I2C Error sending 'M' command: ");
     Serial.println(error);
     return false;
   }
- CustDelay(5);
+  sdWaitReply();
 
   // Request Result (1 byte: 1 for success, 0 for failure)
   bool success = false;
-  uint8_t bytesRead = Wire.requestFrom(I2C_SDCARD, 1, 1);  // Request 1 byte, send STOP
+  uint8_t bytesRead = sdWire.requestFrom(I2C_SDCARD, 1, 1);  // Request 1 byte, send STOP
   if (bytesRead == 1) {
-    success = (Wire.read() == 1);
+    success = (sdWire.read() == 1);
   } else {
+    sdI2CError(metric, SD_ERR_SHORT_READ);
     Serial.print("Error reading mkdir status, expected 1 byte, got ");
     Serial.println(bytesRead);
-    while (Wire.available()) Wire.read();  // Consume any remaining bytes
+    while (sdWire.available()) sdWire.read();  // Consume any remaining bytes
     return false;                          // Assume failure on error
   }
 
@@ -436,39 +428,38 @@ bool mkdir(const char* dirname) {
 }
 
 bool rmdir(const char* dirname) {
+  SDBusOp busOp(SD_OP_DELETE);
   const char* dname = dirname;  // Keep original pointer for printing
-  // Send Directory Name (using 'F' command)
-  Wire.beginTransmission(I2C_SDCARD);
-  Wire.write('F');
-  Wire.write(dirname, strlen(dirname));
-  uint8_t error = Wire.endTransmission();  // Send STOP
-  if (error != 0) {
-    Serial.print("I2C Error sending dirname for rmdir: ");
-    Serial.println(error);
+  sdFileCacheInvalidateDir(dirname);
+  sdDirCacheInvalidateTree(dirname);
+  SDMetric metric(SD_METRIC_DELETE);
+  if (!sendFilename(dirname)) {  // Send Directory Name (using 'F' command)
+    metric.fail();
     return false;
   }
- CustDelay(5);
 
   // Send Remove Directory Command
-  Wire.beginTransmission(I2C_SDCARD);
-  Wire.write('D');                      // 'D' for remove directory
-  error = Wire.endTransmission(false);  // Keep connection active for requestFrom
+  sdWire.beginTransmission(I2C_SDCARD);
+  sdWire.write('D');                      // 'D' for remove directory
+  uint8_t error = sdWire.endTransmission(false);  // Keep connection active for requestFrom
   if (error != 0) {
+    sdI2CError(metric, error);
     Serial.print("I2C Error sending 'D' command: ");
     Serial.println(error);
     return false;
   }
- CustDelay(5);
+  sdWaitReply();
 
   // Request Result (1 byte: 1 for success, 0 for failure)
   bool success = false;
-  uint8_t bytesRead = Wire.requestFrom(I2C_SDCARD, 1, 1);  // Request 1 byte, send STOP
+  uint8_t bytesRead = sdWire.requestFrom(I2C_SDCARD, 1, 1);  // Request 1 byte, send STOP
   if (bytesRead == 1) {
-    success = (Wire.read() == 1);
+    success = (sdWire.read() == 1);
   } else {
+    sdI2CError(metric, SD_ERR_SHORT_READ);
     Serial.print("Error reading rmdir status, expected 1 byte, got ");
     Serial.println(bytesRead);
-    while (Wire.available()) Wire.read();  // Consume any remaining bytes
+    while (sdWire.available()) sdWire.read();  // Consume any remaining bytes
     return false;                          // Assume failure on error
   }
 
@@ -486,17 +477,18 @@ bool rmdir(const char* dirname) {
 // --- Function to Query Card Type ('Q') ---
 void queryCardType() {
   Serial.println("\n--- Querying Card Type ('Q') ---");
-  Wire.beginTransmission(I2C_SDCARD);
-  Wire.write('Q');
-  uint8_t error = Wire.endTransmission(false); // Send command, NO STOP
+  sdWire.beginTransmission(I2C_SDCARD);
+  sdWire.write('Q');
+  uint8_t error = sdWire.endTransmission(false); // Send command, NO STOP
   if (error != 0) {
     Serial.print("  [Error] Failed to send 'Q' command. I2C Error: "); Serial.println(error);
+    sdClockError();
     return;
   }
 
-  uint8_t bytesReceived = Wire.requestFrom(I2C_SDCARD, 1, 1); // Request 1 byte, send STOP
+  uint8_t bytesReceived = sdWire.requestFrom(I2C_SDCARD, 1, 1); // Request 1 byte, send STOP
   if (bytesReceived == 1) {
-    uint8_t cardType = Wire.read();
+    uint8_t cardType = sdWire.read();
     Serial.print("  Card Type Detected: ");
     Serial.print(cardType);
     switch (cardType) {
@@ -508,6 +500,7 @@ void queryCardType() {
     }
   } else {
     Serial.println("  [Error] Did not receive expected byte for card type.");
+    sdClockError();
   }
 }
 
@@ -517,38 +510,39 @@ void getvolsize() {
   Serial.println("Requesting volume data...");
 
   // Send Volume Info Command
-  Wire.beginTransmission(I2C_SDCARD);
-  Wire.write('V');
-  uint8_t error = Wire.endTransmission(false);  // Keep connection active for requestFrom
+  sdWire.beginTransmission(I2C_SDCARD);
+  sdWire.write('V');
+  uint8_t error = sdWire.endTransmission(false);  // Keep connection active for requestFrom
   if (error != 0) {
     Serial.print("I2C Error sending 'V' command: ");
     Serial.println(error);
+    sdClockError();
     return;
   }
  // CustDelay(10);  // Give slave time to prepare data
 
   // Request 10 bytes: Status(1) + FAT Type(1) + Blocks(4) + Clusters(4)
-  uint8_t bytesRead = Wire.requestFrom(I2C_SDCARD, 10, 1);  // Request 10 bytes, send STOP
+  uint8_t bytesRead = sdWire.requestFrom(I2C_SDCARD, 10, 1);  // Request 10 bytes, send STOP
 
   if (bytesRead == 10) {
-    uint8_t status = Wire.read();
+    uint8_t status = sdWire.read();
     Serial.print("Status received: 0x");
     Serial.print(status, HEX);
 
     if (status == 0x01) {  // Success status from ATtiny
     Serial.println(" Success!");
-      uint8_t fatType = Wire.read();
+      uint8_t fatType = sdWire.read();
       uint32_t volBlocks = 0;
       uint32_t volClusters = 0;
 
       // Read Blocks per Cluster (4 bytes LSB first)
       for (int i = 0; i < 4; i++) {
-        volBlocks |= (uint32_t)Wire.read() << (i * 8);
+        volBlocks |= (uint32_t)sdWire.read() << (i * 8);
       }
 
       // Read Cluster Count (4 bytes LSB first)
       for (int i = 0; i < 4; i++) {
-        volClusters |= (uint32_t)Wire.read() << (i * 8);
+        volClusters |= (uint32_t)sdWire.read() << (i * 8);
       }
 
       // --- Corrected FAT Type Printing ---
@@ -589,142 +583,82 @@ void getvolsize() {
     } else if (status == 0xFF) {
       Serial.println("Error: Slave reported failure initializing volume.");
       // Consume remaining bytes if any (should be 9 left)
-      for (int i = 0; i < 9 && Wire.available(); ++i) Wire.read();
+      for (int i = 0; i < 9 && sdWire.available(); ++i) sdWire.read();
     } else {
       Serial.print("Error: Received unexpected status byte: 0x");
       Serial.println(status, HEX);
       // Consume remaining bytes if any
-      while (Wire.available()) Wire.read();
+      while (sdWire.available()) sdWire.read();
     }
   } else {
     Serial.print("Error reading volume info, expected 10 bytes, got ");
     Serial.println(bytesRead);
-    while (Wire.available()) Wire.read();  // Consume any remaining bytes
+    while (sdWire.available()) sdWire.read();  // Consume any remaining bytes
+    sdClockError();
   }
 }
 
 // --- Directory Listing Functions ---
 
 // Helper to parse the streamed directory data
-void parseDirStream() {
+void parseDirStream(SDMetric& metric) {
   fileNames.clear();
   directoryNames.clear();
 
-  bool receiving = true;
-  while (receiving) {
-    uint8_t entryType;
-    String entryName = "";
-    uint32_t entrySize = 0;
-
-    // 1. Read Entry Type (or End Marker)
-    uint8_t bytesRead = Wire.requestFrom(I2C_SDCARD, 1, 0);  // Request 1 byte, keep connection
-    if (bytesRead == 1) {
-      entryType = Wire.read();
-      if (entryType == 0xFF) {  // End marker
-        receiving = false;
-        break;  // Exit the loop
-      }
-      if (entryType != 'F' && entryType != 'D') {
-        Serial.print("\nError: Invalid entry type received: ");
-        Serial.println((char)entryType);
-        receiving = false;  // Stop parsing on error
-        break;
-      }
-    } else {
-      Serial.println("\nError reading entry type.");
-      receiving = false;
-      break;
-    }
-
-    // 2. Read Entry Name (null-terminated)
-    bool nameDone = false;
-    while (!nameDone) {
-      bytesRead = Wire.requestFrom(I2C_SDCARD, 1, 0);  // Read one byte at a time
-      if (bytesRead == 1) {
-        char c = Wire.read();
-        if (c == '\0') {
-          nameDone = true;
-        } else {
-          entryName += c;
-        }
-      } else {
-        Serial.println("\nError reading entry name.");
-        receiving = false;
-        nameDone = true;  // Exit inner loop
-      }
-    }
-    if (!receiving) break;  // Exit outer loop if error occurred
-
-    // 3. Read Entry Size (4 bytes, LSB first) - Only if it's a file
-    if (entryType == 'F') {
-      bytesRead = Wire.requestFrom(I2C_SDCARD, 4, 0);  // Request 4 bytes
-      if (bytesRead == 4) {
-        for (int i = 0; i < 4; i++) {
-          entrySize |= (uint32_t)Wire.read() << (8 * i);
-        }
-      } else {
-        Serial.print("\nError reading entry size, expected 4, got ");
-        Serial.println(bytesRead);
-        receiving = false;
-        break;
-      }
-    } else {                                           // It's a directory ('D'), size is implicitly 0 for listing purposes
-      bytesRead = Wire.requestFrom(I2C_SDCARD, 4, 0);  // Still need to read the 4 size bytes sent by slave
-      if (bytesRead == 4) {
-        for (int i = 0; i < 4; i++) Wire.read();  // Read and discard size bytes for directory
-      } else {
-        Serial.print("\nError reading dummy size for directory, expected 4, got ");
-        Serial.println(bytesRead);
-        receiving = false;
-        break;
-      }
+  SDDirStream dir;
+  SDDirRecord entry;
+  dir.begin();
+  while (true) {
+    SDDirResult result = dir.next(entry);
+    if (result == SD_DIR_END) break;  // End marker
+    if (result == SD_DIR_ERROR) {
+      sdI2CError(metric, SD_ERR_SHORT_READ);
+      Serial.println("\nError reading directory entry.");
+      break;  // Stop parsing on error
     }
 
-
-    // 4. Store the entry
-    if (entryType == 'F') {
-      fileNames.push_back({ entryName, entrySize });
+    // Store the entry
+    if (entry.type == 'F') {
+      fileNames.push_back({ String(entry.name), entry.size });
     } else {  // 'D'
-      directoryNames.push_back(entryName);
+      directoryNames.push_back(String(entry.name));
     }
-    CustDelay(1);  // Small CustDelay before requesting next entry part
-  }            // End while(receiving)
+  }
 
-  Wire.endTransmission();  // Send STOP after finishing or error
+  sdWire.endTransmission();  // Send STOP after finishing or error
+  metric.bytes(dir.bytes());
 }
 
 
 // Main function to initiate and display directory listing
 void dirListFromSD(const char* dirname) {
+  SDBusOp busOp(SD_OP_LIST);
   Serial.println("\r\n----Directory " + String(dirname) + " Start-------");
 
   // 1. Send Directory Name
-  Wire.beginTransmission(I2C_SDCARD);
-  Wire.write('F');
-  Wire.write(dirname, strlen(dirname));
-  uint8_t error = Wire.endTransmission();  // Send STOP
-  if (error != 0) {
-    Serial.print("I2C Error sending dirname for dirList: ");
-    Serial.println(error);
+  if (!sendFilename(dirname)) {
     Serial.println("----Directory End-------");
     return;
   }
- CustDelay(5);
 
-  // 2. Send List Command
-  Wire.beginTransmission(I2C_SDCARD);
-  Wire.write('L');
-  error = Wire.endTransmission(false);  // Keep connection active for requestFrom
-  if (error != 0) {
-    Serial.print("I2C Error sending 'L' command: ");
-    Serial.println(error);
-    Serial.println("----Directory End-------");
-    return;
-  }
-  //CustDelay(10);  // Give slave a bit more time to open dir and get first entry
+  {
+    SDMetric metric(SD_METRIC_LIST);  // timed up to the end of the stream, not the printing
+    // 2. Send List Command
+    sdWire.beginTransmission(I2C_SDCARD);
+    sdWire.write('L');
+    uint8_t error = sdWire.endTransmission(false);  // Keep connection active for requestFrom
+    if (error != 0) {
+      sdI2CError(metric, error);
+      Serial.print("I2C Error sending 'L' command: ");
+      Serial.println(error);
+      Serial.println("----Directory End-------");
+      return;
+    }
+    //CustDelay(10);  // Give slave a bit more time to open dir and get first entry
 
-  // 3. Parse the stream
-  parseDirStream();  // This function now handles reading and populating vectors
+    // 3. Parse the stream
+    parseDirStream(metric);  // This function now handles reading and populating vectors
+  }
 
   // 4. Print the results from vectors
   Serial.println("Directory listing:");
@@ -740,13 +674,16 @@ void dirListFromSD(const char* dirname) {
 
 // --- Function to List Directory Contents ('L') ---
 void listDirectory(const char* dirname) {
+    SDBusOp busOp(SD_OP_LIST);
     Serial.print("--- Listing Directory '"); Serial.print(dirname); Serial.println("' ('L') ---");
     if (!sendFilename(dirname)) return;
 
-    Wire.beginTransmission(I2C_SDCARD);
-    Wire.write('L');
-    uint8_t error = Wire.endTransmission(false); // Send command, NO STOP
+    SDMetric metric(SD_METRIC_LIST);
+    sdWire.beginTransmission(I2C_SDCARD);
+    sdWire.write('L');
+    uint8_t error = sdWire.endTransmission(false); // Send command, NO STOP
     if (error != 0) {
+        sdI2CError(metric, error);
         Serial.print("  [Error] Failed to send 'L' command. I2C Error: "); Serial.println(error);
         return;
     }
@@ -754,95 +691,159 @@ void listDirectory(const char* dirname) {
     Serial.println("  Type | Size       | Name");
     Serial.println("  ----------------------------");
 
+    SDDirStream dir;
+    SDDirRecord entry;
+    dir.begin();
     bool firstEntry = true;
     while (true) {
-        // Request Type byte
-        uint8_t bytesReceived = Wire.requestFrom(I2C_SDCARD, 1, 0); // NO STOP yet
-        if (bytesReceived != 1) {
-            Serial.println("  [Error] Failed to receive Type byte.");
-            Wire.endTransmission(true); // Send STOP to abort
+        SDDirResult result = dir.next(entry);
+        if (result == SD_DIR_ERROR) {
+            sdI2CError(metric, SD_ERR_SHORT_READ);
+            metric.bytes(dir.bytes());
+            Serial.println("  [Error] Failed to read directory entry.");
+            sdWire.endTransmission(true); // Send STOP to abort
             return;
         }
-        uint8_t entryType = Wire.read();
-
-        if (entryType == 0xFF) { // End of listing marker
+        if (result == SD_DIR_END) { // End of listing marker
             if (firstEntry) {
                 Serial.println("  (Directory is empty or does not exist)");
             }
-            Wire.endTransmission(true); // Send final STOP
+            sdWire.endTransmission(true); // Send final STOP
             break;
         }
         firstEntry = false;
 
-        // Read Name (null-terminated string)
-        String entryName = "";
-        while (true) {
-            bytesReceived = Wire.requestFrom(I2C_SDCARD, 1, 0); // NO STOP
-            if (bytesReceived != 1) {
-                 Serial.println("\n  [Error] Failed to receive Name byte.");
-                 Wire.endTransmission(true); // Send STOP to abort
-                 return;
-            }
-            char c = Wire.read();
-            if (c == '\0') break; // End of name
-            entryName += c;
-        }
-
-        // Read Size (4 bytes, LSB first)
-        uint32_t entrySize = 0;
-        bytesReceived = Wire.requestFrom(I2C_SDCARD, 4, 0); // NO STOP
-        if (bytesReceived == 4) {
-             for (int i = 0; i < 4; i++) {
-                entrySize |= ((uint32_t)Wire.read() << (8 * i));
-             }
-        } else {
-             Serial.print("\n  [Error] Failed to receive Size bytes (received ");
-             Serial.print(bytesReceived); Serial.println(").");
-             Wire.endTransmission(true); // Send STOP to abort
-             return;
-        }
-
         // Print entry
         Serial.print("  ");
-        Serial.print((char)entryType); // 'D' or 'F'
+        Serial.print((char)entry.type); // 'D' or 'F'
         Serial.print("    | ");
-        if (entryType == 'F') {
+        if (entry.type == 'F') {
             char sizeBuf[11];
-            sprintf(sizeBuf, "%10lu", entrySize); // Format size right-aligned
+            sprintf(sizeBuf, "%10lu", (unsigned long)entry.size); // Format size right-aligned
             Serial.print(sizeBuf);
         } else {
             Serial.print("         -"); // Placeholder for directory size
         }
         Serial.print(" | ");
-        Serial.println(entryName);
-
-        // The ATtiny automatically prepares for the next entry type request
-        // or sends 0xFF if done. The loop continues.
+        Serial.println(entry.name);
     }
      Serial.println("  ----------------------------");
-     Wire.endTransmission();
+     sdWire.endTransmission();
+     metric.bytes(dir.bytes());
 }
 
-// --- Function to Generate HTML Directory Listing ('L') ---
-String listDirectory_HTML(const char* dirname, int page = 1, int perPage = 20) { // Max file lising 20, page navigation
-    String html = "";
-    html.reserve(11264);
-
-    html += "<!DOCTYPE html>\n<html>\n<head>\n<title>Directory: ";
-    html += dirname;
-    html += "</title>\n";
-    html += "<style>\n";
-    html += "body { font-family: sans-serif; }\n";
-    html += "table { border-collapse: collapse; width: 30%; }\n";
-    html += "th, td { border: 1px solid #ddd; padding: 8px; }\n";
-    html += "th { background-color: #f2f2f2; }\n";
-    html += "a { text-decoration: none; color: blue; }\n";
-    html += "a:hover { text-decoration: underline; }\n";
-    html += "</style>\n";
-    html += "</head>\n<body>\n";
-    html += "<h1>Directory Listing: ";
-    html += dirname;
-    html += "</h1>\n";
+// --- Buffered chunked response ---
+// Collects small pieces of a response and hands them to server.sendContent() in blocks, so pages can be
+// streamed while they are generated without one TCP write per fragment and without building them in a String.
+class ChunkedResponse : public Print {
+  public:
+    void begin(int code, const char* contentType) {
+        len = 0;
+        server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+        server.send(code, contentType, "");
+    }
+    size_t write(uint8_t c) override {
+        if (len == sizeof(buf)) flush();
+        buf[len++] = c;
+        return 1;
+    }
+    size_t write(const uint8_t* data, size_t size) override {
+        size_t done = 0;
+        while (done < size) {
+            if (len == sizeof(buf)) flush();
+            size_t n = min(size - done, sizeof(buf) - len);
+            memcpy(buf + len, data + done, n);
+            len += n;
+            done += n;
+        }
+        return size;
+    }
+    using Print::write;
+    void flush() override {
+        if (len == 0) return;
+        server.sendContent(buf, len);
+        len = 0;
+    }
+    void end() {
+        flush();
+        server.sendContent("");  // terminating chunk
+    }
+
+  private:
+    char buf[1024];
+    size_t len = 0;
+};
+
+// Writes one table row of the directory listing
+void sendDirRow_HTML(Print& out, const char* dirname, uint8_t entryType, const char* entryName, uint32_t entrySize) {
+    String entryPath = String(dirname);
+    if (entryPath.length() > 1 && !entryPath.endsWith("/")) {
+        entryPath += "/";
+    }
+    entryPath += entryName;
+
+    out.print(F("<tr>\n<td align=center>["));
+    out.print((char)entryType);
+    out.print(F("]</td>\n"));
+
+    // Delete Column
+    out.print(F("<td align=center>"));
+    if (entryType == 'F') {
+        out.print(F("<form method='POST' action='/deleteFile' style='display:inline;' onsubmit=\"return confirm('Delete file "));
+        out.print(entryName);
+        out.print(F("?');\"><input type='hidden' name='file' value='"));
+        out.print(entryPath);
+        out.print(F("'/><button type='submit' style='color:red;'>Delete</button></form>"));
+    } else {
+        out.print(F("&mdash;"));
+    }
+    out.print(F("</td>\n"));
+
+    // Name Column (with link)
+    out.print(F("<td align=right><a href=\""));
+    if (entryType == 'D') {
+        out.print(F("./listSDCard?DIR="));
+        out.print(entryPath);
+        out.print(F("/\">"));
+        out.print(entryName);
+        out.print('/');
+    } else {
+        out.print('.');
+        out.print(entryPath);
+        out.print(F("\">"));
+        out.print(entryName);
+    }
+    out.print(F("</a></td>\n<td>"));
+    if (entryType == 'F') {
+        out.print(entrySize);
+    } else {
+        out.print(F("---"));
+    }
+    out.print(F("</td>\n</tr>\n"));
+}
+
+// --- Function to Send an HTML Directory Listing ('L') ---
+// The page is streamed with chunked transfer: the head goes out before the bus is touched and rows are written as
+// entries come off the bus, so memory use does not grow with the directory (beyond what the listing cache may keep).
+void listDirectory_HTML(const char* dirname, int page = 1, int perPage = 20) { // Max file lising 20, page navigation
+    ChunkedResponse out;
+    out.begin(200, "text/html");
+
+    out.print(F("<!DOCTYPE html>\n<html>\n<head>\n<title>Directory: "));
+    out.print(dirname);
+    out.print(F("</title>\n"
+                "<style>\n"
+                "body { font-family: sans-serif; }\n"
+                "table { border-collapse: collapse; width: 30%; }\n"
+                "th, td { border: 1px solid #ddd; padding: 8px; }\n"
+                "th { background-color: #f2f2f2; }\n"
+                "a { text-decoration: none; color: blue; }\n"
+                "a:hover { text-decoration: underline; }\n"
+                "</style>\n"
+                "</head>\n<body>\n"
+                "<h1>Directory Listing: "));
+    out.print(dirname);
+    out.print(F("</h1>\n"));
 
     String currentDir = String(dirname);
     if (currentDir != "/") {
@@ -857,210 +858,248 @@ String listDirectory_HTML(const char* dirname, int page = 1, int perPage = 20) {
             parentDir = currentDir.substring(0, lastSlash);
             if (parentDir.length() == 0) parentDir = "/";
         }
-        html += "<p><a href=\"./listSDCard?DIR=";
-        html += parentDir;
-        html += "\">&#8592; Go up</a></p>\n";
+        out.print(F("<p><a href=\"./listSDCard?DIR="));
+        out.print(parentDir);
+        out.print(F("\">&#8592; Go up</a></p>\n"));
     }
-
-    if (!sendFilename(dirname)) {
-        Wire.setClock(i2c_bus_Clock); //back to defualt
-        CustDelay(5);
-        Wire.beginTransmission(I2C_SDCARD);
-        byte errorsd = Wire.endTransmission();
-       if (errorsd == 0) {
-         Detected_i2cSDCard = true;
-       } else {
-        if (i2cSDCarderrcnt > 5) {
-           Detected_i2cSDCard = false;
+    out.flush(); // Let the browser start rendering while the directory is read
+
+    uint32_t startIdx = (uint32_t)(page - 1) * perPage;
+    uint32_t endIdx = startIdx + perPage;
+    uint32_t totalEntries = 0;  // known once the end of the listing has been seen
+    bool complete = false;
+    bool hasMore = false;
+
+    out.print(F("<table>\n<tr><th align=center>Type</th><th align=center>Delete</th><th align=center>Name</th><th align=center>Size (Bytes)</th></tr>\n"));
+
+    // Paging and the redirect after a delete re-render the same directory, so reuse the last scan when possible
+    const std::vector<SDDirEntry>* cachedEntries = sdDirCacheLookup(dirname);
+    if (cachedEntries) {
+        totalEntries = cachedEntries->size();
+        complete = true;
+        for (uint32_t i = startIdx; i < endIdx && i < totalEntries; i++) {
+            const SDDirEntry& e = (*cachedEntries)[i];
+            sendDirRow_HTML(out, dirname, e.type, e.name.c_str(), e.size);
+        }
+    } else {
+        SDBusOp busOp(SD_OP_LIST);
+        SDMetric metric(SD_METRIC_LIST);
+        if (!sdDirSeek(dirname, startIdx, metric)) {
+           if (sdWaitReady()) {
+             Detected_i2cSDCard = true;
+           } else {
+            if (i2cSDCarderrcnt > 5) {
+               Detected_i2cSDCard = false;
+            }
+             i2cSDCarderrcnt++;
+           }
+            out.print(F("</table>\n<p>Error: Could not list the directory on the device.</p></body></html>"));
+            out.end();
+            return;
         }
-         i2cSDCarderrcnt++;
-       }
-        html += "<p>Error: Could not set directory path on device.</p>";
 
-        html += "</body></html>";
-        return html;
-    }
-    Wire.setClock(200000);
-    CustDelay(5);
-    Wire.beginTransmission(I2C_SDCARD);
-    Wire.endTransmission();
-    CustDelay(5);
-    Wire.beginTransmission(I2C_SDCARD);
-    Wire.write('L');
-    uint8_t error = Wire.endTransmission(false);
-    if (error != 0) {
-        html += "<p>Error: Failed to send 'L' command. I2C Error: ";
-        html += String(error);
-        html += "</p>";
-        html += "</body></html>";
-        return html;
+        // Only this page's rows (and one entry ahead, to know whether there is a next page) come off the bus.
+        // A first page is also kept for the listing cache: if the directory turns out to fit in the cache
+        // budget, the rest of it is read too, so the other pages and the redraw after a delete need no scan.
+        std::vector<SDDirEntry> cacheFill;
+        uint32_t cacheFillBytes = 0;
+        bool caching = startIdx == 0 && sdDirCacheBudget > 0;
+        SDDirRecord entry;
+        SDDirResult result = SD_DIR_ENTRY;
+        while (sdDirIndex() < endIdx) {
+            result = sdDirNext(entry);
+            if (result != SD_DIR_ENTRY) break;
+            sendDirRow_HTML(out, dirname, entry.type, entry.name, entry.size);
+            if (caching) {
+                cacheFill.push_back({ entry.type, String(entry.name), entry.size });
+                cacheFillBytes += sdDirEntryBytes(cacheFill.back());
+            }
+        }
+        if (result == SD_DIR_ENTRY) result = sdDirPeek();
+        while (result == SD_DIR_ENTRY && caching && cacheFillBytes <= sdDirCacheBudget) {
+            result = sdDirNext(entry);
+            if (result != SD_DIR_ENTRY) break;
+            cacheFill.push_back({ entry.type, String(entry.name), entry.size });
+            cacheFillBytes += sdDirEntryBytes(cacheFill.back());
+        }
+        if (result == SD_DIR_ERROR) {
+            sdI2CError(metric, SD_ERR_SHORT_READ);
+        }
+        // A listing started past its end with 'N' ends at once without telling how many entries there are
+        complete = result == SD_DIR_END && (startIdx == 0 || sdDirIndex() > startIdx);
+        hasMore = result == SD_DIR_ENTRY;
+        totalEntries = sdDirIndex();
+        sdDirPark(metric);
+        if (caching && complete && cacheFillBytes <= sdDirCacheBudget) {
+            sdDirCacheInsert(dirname, cacheFill, sdDirCursor.cacheGeneration);
+        }
     }
 
-    html += "<table>\n";
-    html += "<tr><th align=center>Type</th><th align=center>Delete</th><th align=center>Name</th><th align=center>Size (Bytes)</th></tr>\n";
-
-    bool firstEntry = true;
-    bool i2c_error = false;
-    const int maxEntries = 128; // Prevent infinite loops
-    int entryCount = 0;
-    int startIdx = (page - 1) * perPage;
-    int endIdx = page * perPage;
-    int totalEntries = 0;
-
-    // We'll collect all entries first to count total and then display only the current page
-    struct Entry {
-        uint8_t entryType;
-        String entryName;
-        uint32_t entrySize;
-    };
-    Entry entries[maxEntries];
-
-    while (totalEntries < maxEntries) {
-        yield(); // Prevent watchdog reset
-
-        uint8_t bytesReceived = Wire.requestFrom(I2C_SDCARD, 1, 0);
-        if (bytesReceived != 1) {
-            break;
-        }
-        uint8_t entryType = Wire.read();
+    if (complete && totalEntries == 0) {
+        out.print(F("<tr><td colspan='4'>(Directory is empty)</td></tr>\n"));
+    } else if (totalEntries <= startIdx) {
+        out.print(F("<tr><td colspan='4'>(No entries on this page)</td></tr>\n"));
+    }
 
-        if (entryType == 0xFF) {
-            break;
-        }
+    // Pagination controls. The number of pages is only known when the whole directory has been seen.
+    uint32_t totalPages = (totalEntries + perPage - 1) / perPage;
+    if (complete) hasMore = (uint32_t)page < totalPages;
+    out.print(F("</table>\n<div style='margin-top:10px;'>"));
+    if (page > 1) {
+        out.print(F("<a href='/listSDCard?DIR="));
+        out.print(dirname);
+        out.print(F("&page="));
+        out.print(page - 1);
+        out.print(F("&perPage="));
+        out.print(perPage);
+        out.print(F("'>&laquo; Prev</a> "));
+    }
+    out.print(F(" Page "));
+    out.print(page);
+    if (complete) {
+        out.print(F(" of "));
+        out.print(totalPages);
+    }
+    if (hasMore) {
+        out.print(F(" <a href='/listSDCard?DIR="));
+        out.print(dirname);
+        out.print(F("&page="));
+        out.print(page + 1);
+        out.print(F("&perPage="));
+        out.print(perPage);
+        out.print(F("'>Next &raquo;</a>"));
+    }
+    // Upload form; the script posts it in the background to show progress, then reloads the listing
+    out.print(F("</div>\n<form method='POST' enctype='multipart/form-data' style='margin-top:10px;' onsubmit='return upload(this)' action='/upload?DIR="));
+    out.print(dirname);
+    out.print(F("'><input type='file' name='file'/> <button type='submit'>Upload</button> "
+                "<progress id='upbar' max='100' value='0' hidden></progress> <span id='upmsg'></span></form>\n"
+                "<script>\n"
+                "function upload(f) {\n"
+                "  var x = new XMLHttpRequest(), bar = document.getElementById('upbar');\n"
+                "  bar.hidden = false;\n"
+                "  x.upload.onprogress = function(e) { if (e.lengthComputable) bar.value = e.loaded * 100 / e.total; };\n"
+                "  x.onload = function() { if (x.status == 200) location.reload(); else document.getElementById('upmsg').textContent = x.responseText; };\n"
+                "  x.open('POST', f.action);\n"
+                "  x.send(new FormData(f));\n"
+                "  return false;\n"
+                "}\n"
+                "</script>\n</body>\n</html>\n"));
+    out.end();
+}
 
-        // Read Name (null-terminated string) into a fixed buffer
-        char entryNameBuf[32] = {0};
-        uint8_t nameIdx = 0;
-        int nameTimeout = 0;
-        while (true) {
-            yield();
-            bytesReceived = Wire.requestFrom(I2C_SDCARD, 1, 0);
-            if (bytesReceived != 1) {
-                break;
-            }
-            char c = Wire.read();
-            if (c == '\0') break;
-            if (nameIdx < sizeof(entryNameBuf) - 1) {
-                entryNameBuf[nameIdx++] = c;
-            }
-            if (++nameTimeout > 64) {
-                break;
-            }
-        }
+// --- JSON Directory Listing API ---
+#define SD_API_LIST_LIMIT 100       // entries per /api/list response without ?limit=
+#define SD_API_LIST_LIMIT_MAX 1000  // the handler holds the loop for the whole response
+
+// Length of the well-formed UTF-8 sequence at s (1 for ASCII), or 0 if s does not start one
+uint8_t utf8SequenceLength(const uint8_t* s) {
+    uint8_t c = s[0];
+    if (c < 0x80) return 1;
+    uint8_t len;
+    uint8_t lo = 0x80, hi = 0xBF;  // allowed range of the second byte
+    if (c >= 0xC2 && c <= 0xDF) len = 2;
+    else if (c >= 0xE0 && c <= 0xEF) {
+        len = 3;
+        if (c == 0xE0) lo = 0xA0;       // overlong
+        else if (c == 0xED) hi = 0x9F;  // UTF-16 surrogates
+    } else if (c >= 0xF0 && c <= 0xF4) {
+        len = 4;
+        if (c == 0xF0) lo = 0x90;       // overlong
+        else if (c == 0xF4) hi = 0x8F;  // past U+10FFFF
+    } else return 0;
+    if (s[1] < lo || s[1] > hi) return 0;
+    for (uint8_t i = 2; i < len; i++) {
+        if ((s[i] & 0xC0) != 0x80) return 0;
+    }
+    return len;
+}
 
-        // Read Size (4 bytes, LSB first)
-        uint32_t entrySize = 0;
-        bytesReceived = Wire.requestFrom(I2C_SDCARD, 4, 0);
-        if (bytesReceived == 4) {
-            for (int i = 0; i < 4; i++) {
-                entrySize |= ((uint32_t)Wire.read() << (8 * i));
-            }
+// Writes s as a JSON string. Names come from the card as they are: quotes, backslashes and control characters
+// are escaped, and bytes that are not UTF-8 (8.3 names in the card's OEM code page) become U+FFFD, so the
+// response always parses.
+void sendJsonString(Print& out, const char* s) {
+    out.print('"');
+    const uint8_t* p = (const uint8_t*)s;
+    while (*p) {
+        uint8_t c = *p;
+        uint8_t len = utf8SequenceLength(p);
+        if (c == '"' || c == '\\') {
+            out.print('\\');
+            out.print((char)c);
+        } else if (c < 0x20 || c == 0x7F) {
+            char esc[7];
+            snprintf(esc, sizeof(esc), "\\u%04x", c);
+            out.print(esc);
+        } else if (len == 0) {
+            out.print(F("\\ufffd"));
+            len = 1;
+        } else {
+            out.write(p, len);
         }
-
-        entries[totalEntries].entryType = entryType;
-        entries[totalEntries].entryName = String(entryNameBuf);
-        entries[totalEntries].entrySize = entrySize;
-        totalEntries++;
+        p += len;
     }
+    out.print('"');
+}
 
-    // Now display only the entries for the current page
-    if (totalEntries == 0) {
-        html += "<tr><td colspan='4'>(Directory is empty)</td></tr>\n";
-    } else {
-        for (int i = startIdx; i < endIdx && i < totalEntries; i++) {
-            uint8_t entryType = entries[i].entryType;
-            String entryNameBuf = entries[i].entryName;
-            uint32_t entrySize = entries[i].entrySize;
-
-            html += "<tr>\n";
-            html += "<td align=center>[";
-            html += (char)entryType;
-            html += "]</td>\n";
-
-            // Delete Column
-            html += "<td align=center>";
-            if (entryType == 'F') {
-                html += "<form method='POST' action='/deleteFile' style='display:inline;' onsubmit=\"return confirm('Delete file ";
-                html += entryNameBuf;
-                html += "?');\">";
-                html += "<input type='hidden' name='file' value='";
-                String deletePath = String(dirname);
-                if (deletePath.length() > 1 && !deletePath.endsWith("/")) {
-                    deletePath += "/";
-                } else if (deletePath == "/") {
-                    deletePath = "/";
-                }
-                deletePath += entryNameBuf;
-                html += deletePath;
-                html += "'/>";
-                html += "<button type='submit' style='color:red;'>Delete</button>";
-                html += "</form>";
-            } else {
-                html += "&mdash;";
-            }
-            html += "</td>\n";
-
-            // Name Column (with link)
-            html += "<td align=right><a href=\"";
-            String entryPath = String(dirname);
-            if (entryPath.length() > 1 && !entryPath.endsWith("/")) {
-                entryPath += "/";
-            } else if (entryPath == "/") {
-                entryPath = "/";
-            }
-            entryPath += entryNameBuf;
-
-            if (entryType == 'D') {
-                html += "./listSDCard?DIR=";
-                html += entryPath;
-                html += "/\">";
-                html += entryNameBuf;
-                html += "/";
-            } else {
-                html += ".";
-                html += entryPath;
-                html += "\">";
-                html += entryNameBuf;
-            }
-            html += "</a></td>\n";
+void sendDirEntry_JSON(Print& out, bool first, uint8_t entryType, const char* entryName, uint32_t entrySize) {
+    out.print(first ? F("{\"type\":\"") : F(",{\"type\":\""));
+    out.print(entryType == 'D' ? F("dir") : F("file"));
+    out.print(F("\",\"name\":"));
+    sendJsonString(out, entryName);
+    out.print(F(",\"size\":"));
+    out.print(entrySize);
+    out.print(F(",\"mtime\":null}"));
+}
 
-            html += "<td>";
-            if (entryType == 'F') {
-                html += String(entrySize);
-            } else {
-                html += "---";
-            }
-            html += "</td>\n";
-            html += "</tr>\n";
+void handleListApi() {
+    String dirname = server.arg("DIR");
+    if (dirname.length() == 0) dirname = "/";
+    long offset = server.hasArg("offset") ? server.arg("offset").toInt() : 0;
+    long limit = server.hasArg("limit") ? server.arg("limit").toInt() : SD_API_LIST_LIMIT;
+    if (offset < 0) offset = 0;
+    if (limit < 1) limit = SD_API_LIST_LIMIT;
+    if (limit > SD_API_LIST_LIMIT_MAX) limit = SD_API_LIST_LIMIT_MAX;
+    uint32_t endIdx = (uint32_t)offset + limit;
+
+    const std::vector<SDDirEntry>* cachedEntries = sdDirCacheLookup(dirname.c_str());
+    if (cachedEntries) {
+        ChunkedResponse out;
+        out.begin(200, "application/json");
+        out.print('[');
+        for (uint32_t i = offset; i < endIdx && i < cachedEntries->size(); i++) {
+            const SDDirEntry& e = (*cachedEntries)[i];
+            sendDirEntry_JSON(out, i == (uint32_t)offset, e.type, e.name.c_str(), e.size);
         }
+        out.print(']');
+        out.end();
+        return;
     }
 
-    // Pagination controls
-    int totalPages = (totalEntries + perPage - 1) / perPage;
-    html += "</table>\n";
-    html += "<div style='margin-top:10px;'>";
-    if (page > 1) {
-        html += "<a href='/listSDCard?DIR=";
-        html += dirname;
-        html += "&page=";
-        html += String(page - 1);
-        html += "'>&laquo; Prev</a> ";
+    SDBusOp busOp(SD_OP_LIST);
+    SDMetric metric(SD_METRIC_LIST);
+    if (!sdDirSeek(dirname.c_str(), offset, metric)) {
+        server.send(500, "application/json", "{\"error\":\"could not list the directory on the device\"}");
+        return;
     }
-    html += " Page ";
-    html += String(page);
-    html += " of ";
-    html += String(totalPages);
-    if (page < totalPages) {
-        html += " <a href='/listSDCard?DIR=";
-        html += dirname;
-        html += "&page=";
-        html += String(page + 1);
-        html += "'>Next &raquo;</a>";
+    ChunkedResponse out;
+    out.begin(200, "application/json");
+    out.print('[');
+    SDDirRecord entry;
+    SDDirResult result = SD_DIR_END;
+    while (sdDirIndex() < endIdx) {
+        bool first = sdDirIndex() == (uint32_t)offset;
+        result = sdDirNext(entry);
+        if (result != SD_DIR_ENTRY) break;
+        sendDirEntry_JSON(out, first, entry.type, entry.name, entry.size);
     }
-    html += "</div>";
-    html += "</body>\n</html>\n";
-
-    return html;
+    if (result == SD_DIR_ERROR) {
+        sdI2CError(metric, SD_ERR_SHORT_READ);
+    }
+    sdDirPark(metric);
+    // A listing that failed midway is left without its closing bracket, so it cannot pass for a shorter directory
+    if (result != SD_DIR_ERROR) out.print(']');
+    out.end();
 }
 
 void handleDeleteFile() {
@@ -1090,11 +1129,441 @@ void handleDeleteFile() {
     }
 }
 
+// --- Uploads ---
+// The core hands the request body to handleUpload() in pieces of up to HTTP_UPLOAD_BUFLEN bytes, all within one
+// handleClient() call, so no other request touches the bus between the pieces and the path selected with 'F' at the
+// start stays selected. Each piece goes to the card straight from the core's buffer (an unbuffered SDFileWriter).
+
+#define SD_UPLOAD_REPORT_BYTES 16384   // progress is printed every this many bytes
+
+struct SDUploadState {
+  String path;             // empty until an upload has started
+  uint32_t written = 0;    // set once the file is complete
+  uint32_t started = 0;    // millis()
+  uint32_t nextReport = 0;
+  bool failed = false;
+  String error;
+};
+
+SDUploadState sdUpload;
+SDFileWriter sdUploadFile;
+
+void sdUploadFail(const char* what) {
+  sdUpload.failed = true;
+  Serial.print("Upload of ");
+  Serial.print(sdUpload.path);
+  Serial.print(" failed: ");
+  Serial.print(what);
+  Serial.print(" ");
+  Serial.println(sdUpload.error);
+  bool created = sdUploadFile.bytesWritten() > 0;
+  sdUploadFile.abort();
+  if (created) removeFile(sdUpload.path.c_str());  // do not leave a truncated file behind
+}
+
+void handleUpload() {
+  HTTPUpload& upload = server.upload();
+  SDBusOp busOp(SD_OP_WRITE);
+  if (upload.status == UPLOAD_FILE_START) {
+    sdUpload = SDUploadState();
+    sdUploadFile.abort();  // left open by an upload whose END never came
+    String dir = server.arg("DIR");
+    if (!dir.startsWith("/")) dir = "/" + dir;
+    while (dir.length() > 1 && dir.endsWith("/")) dir.remove(dir.length() - 1);
+    String name = upload.filename;  // browsers may send a full client-side path
+    int sep = max(name.lastIndexOf('/'), name.lastIndexOf('\\'));
+    if (sep >= 0) name = name.substring(sep + 1);
+    sdUpload.path = dir == "/" ? "/" + name : dir + "/" + name;
+    sdUpload.started = millis();
+    sdUpload.nextReport = SD_UPLOAD_REPORT_BYTES;
+    if (name.length() == 0) {
+      sdUpload.error = "no file name";
+      sdUploadFail("");
+      return;
+    }
+    if (dir != "/" && !checkExists(dir.c_str(), true)) {
+      sdUpload.error = "no such directory";
+      sdUploadFail("");
+      return;
+    }
+    Serial.print("Upload to ");
+    Serial.println(sdUpload.path);
+    sdClockUse(SD_CLOCK_CONTROL);
+    sdUploadFile.open(sdUpload.path.c_str(), false, 0);
+    return;
+  }
+  if (sdUpload.failed) return;  // the rest of the body is discarded
+
+  if (upload.status == UPLOAD_FILE_WRITE) {
+    if (sdUploadFile.write(upload.buf, upload.currentSize) != upload.currentSize) {
+      sdUpload.error = "I2C error or timeout";
+      sdUploadFail("writing");
+      return;
+    }
+    uint32_t written = sdUploadFile.bytesWritten();
+    if (written >= sdUpload.nextReport) {
+      Serial.print("  ");
+      Serial.print(written);
+      Serial.print(" bytes");
+      if (upload.contentLength > 0) {  // includes the multipart framing, so slightly more than the file
+        Serial.print(" (");
+        Serial.print(min(100UL, (unsigned long)((uint64_t)written * 100 / upload.contentLength)));
+        Serial.print("%)");
+      }
+      Serial.println();
+      sdUpload.nextReport += SD_UPLOAD_REPORT_BYTES;
+    }
+  } else if (upload.status == UPLOAD_FILE_END) {
+    uint32_t written = sdUploadFile.bytesWritten();
+    if (!sdUploadFile.close()) {  // an empty upload is only created here
+      sdUpload.error = "could not create the file";
+      sdUploadFail("");
+      return;
+    }
+    sdUpload.written = written;
+    int stored = GetFileSize(sdUpload.path.c_str());  // also catches a missing directory, which 'W' does not report
+    if (stored != (int)written) {
+      sdUpload.error = "the card holds " + String(stored) + " bytes";
+      sdUploadFail("verifying");
+      return;
+    }
+    Serial.print("Upload complete: ");
+    Serial.print(sdUpload.written);
+    Serial.print(" bytes in ");
+    Serial.print(millis() - sdUpload.started);
+    Serial.println(" ms");
+  } else if (upload.status == UPLOAD_FILE_ABORTED) {
+    sdUpload.error = "client went away";
+    sdUploadFail("");
+  }
+}
+
+void handleUploadDone() {
+  if (sdUpload.path.length() == 0) {
+    server.send(400, "text/plain", "No file in the request");
+  } else if (sdUpload.failed) {
+    server.send(500, "text/plain", "Upload of " + sdUpload.path + " failed: " + sdUpload.error);
+  } else {
+    uint32_t ms = max(1UL, (unsigned long)(millis() - sdUpload.started));
+    server.send(200, "text/plain", "Uploaded " + sdUpload.path + ": " + String(sdUpload.written) + " bytes in " +
+                String(ms) + " ms (" + String((uint32_t)((uint64_t)sdUpload.written * 1000 / ms)) + " B/s)");
+  }
+  sdUpload = SDUploadState();  // a later request without a file part must not report this upload again
+}
+
+// --- Pre-compressed assets ---
+
+// True if the request's Accept-Encoding allows gzip (and does not turn it off with q=0)
+bool acceptsGzip() {
+    String accept = server.header("Accept-Encoding");
+    accept.toLowerCase();
+    int idx = accept.indexOf("gzip");
+    if (idx < 0) return false;
+    int end = accept.indexOf(',', idx);
+    String params = accept.substring(idx + 4, end < 0 ? accept.length() : end);
+    int q = params.indexOf("q=");
+    return q < 0 || params.substring(q + 2).toFloat() > 0;
+}
+
+// --- Conditional GET (ETag / Last-Modified) and Cache-Control ---
+
+// Days since 1970-01-01 of a calendar date
+int32_t daysFromCivil(int y, unsigned m, unsigned d) {
+    y -= m <= 2;
+    int32_t era = (y >= 0 ? y : y - 399) / 400;
+    unsigned yoe = (unsigned)(y - era * 400);
+    unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (int32_t)doe - 719468;
+}
+
+// Formats a FAT date/time as an HTTP date ("Sun, 06 Nov 1994 08:49:37 GMT"). The bridge clock has no time
+// zone, so its time is taken as GMT. Returns an empty String for an invalid date.
+String httpDateFromFat(uint32_t fat) {
+    static const char days[] = "ThuFriSatSunMonTueWed";
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    unsigned year = 1980 + (fat >> 25);
+    unsigned month = (fat >> 21) & 0x0F;
+    unsigned day = (fat >> 16) & 0x1F;
+    if (month < 1 || month > 12 || day < 1) return String();
+    int32_t dow = daysFromCivil(year, month, day) % 7;
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.3s, %02u %.3s %04u %02u:%02u:%02u GMT", days + dow * 3, day, months + (month - 1) * 3,
+             year, (unsigned)((fat >> 11) & 0x1F), (unsigned)((fat >> 5) & 0x3F), (unsigned)((fat & 0x1F) * 2));
+    return String(buf);
+}
+
+// Parses an HTTP date (IMF-fixdate) into the FAT date/time layout, so it can be compared with file times.
+// Returns 0 if the date cannot be parsed.
+uint32_t fatFromHttpDate(const String& date) {
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    char mon[4] = {0};
+    int day, year, hour, minute, second;
+    if (sscanf(date.c_str(), "%*3s, %d %3s %d %d:%d:%d", &day, mon, &year, &hour, &minute, &second) != 6) return 0;
+    const char* found = strstr(months, mon);
+    if (!found || strlen(mon) != 3 || (found - months) % 3 != 0) return 0;
+    unsigned month = (found - months) / 3 + 1;
+    if (year < 1980 || year > 2107) return 0;
+    return ((uint32_t)(year - 1980) << 25) | ((uint32_t)month << 21) | ((uint32_t)day << 16) |
+           ((uint32_t)hour << 11) | ((uint32_t)minute << 5) | (uint32_t)(second / 2);
+}
+
+// Strong validator from size and modification time; files whose time is unknown get none.
+String makeETag(uint32_t size, uint32_t modified) {
+    if (modified == 0) return String();
+    return "\"" + String(size, HEX) + "-" + String(modified, HEX) + "\"";
+}
+
+// Cache-Control value for a MIME type, from cacheControlRules (first matching prefix wins)
+const char* cacheControlFor(const String& dataType) {
+    for (const auto& rule : cacheControlRules) {
+        if (dataType.startsWith(rule.typePrefix)) return rule.cacheControl;
+    }
+    return "no-cache";
+}
+
+void sendValidatorHeaders(const String& dataType, uint32_t size, uint32_t modified, bool gzip) {
+    server.sendHeader("Cache-Control", cacheControlFor(dataType));
+    if (gzip) server.sendHeader("Vary", "Accept-Encoding");
+    if (modified == 0) return;
+    server.sendHeader("ETag", makeETag(size, modified));
+    String lastModified = httpDateFromFat(modified);
+    if (lastModified.length() > 0) server.sendHeader("Last-Modified", lastModified);
+}
+
+// Answers the request with 304 if its If-None-Match / If-Modified-Since still matches the file.
+// Returns true if the 304 has been sent.
+bool sendNotModified(const String& dataType, uint32_t size, uint32_t modified, bool gzip) {
+    if (modified == 0) return false;
+    bool match;
+    if (server.hasHeader("If-None-Match") && server.header("If-None-Match").length() > 0) {
+        String tags = server.header("If-None-Match");  // If-None-Match takes precedence over If-Modified-Since
+        match = tags.indexOf(makeETag(size, modified)) >= 0 || tags == "*";
+    } else {
+        uint32_t since = fatFromHttpDate(server.header("If-Modified-Since"));
+        match = since != 0 && modified <= since;  // FAT date/time fields compare in order
+    }
+    if (!match) return false;
+    sendValidatorHeaders(dataType, size, modified, gzip);
+    server.send(304, dataType, "");
+    return true;
+}
+
+// --- Partial downloads (HTTP Range) ---
+
+// Parses the decimal digits of s into value. Returns false if s is empty or not a number.
+bool parseRangeNumber(String s, uint32_t& value) {
+    s.trim();
+    if (s.length() == 0 || s.length() > 10) return false;
+    uint64_t v = 0;
+    for (unsigned int i = 0; i < s.length(); i++) {
+        if (s[i] < '0' || s[i] > '9') return false;
+        v = v * 10 + (s[i] - '0');
+    }
+    if (v > 0xFFFFFFFFUL) return false;
+    value = (uint32_t)v;
+    return true;
+}
+
+// Whether the request's If-Range (if any) still names the file: its ETag, or exactly its Last-Modified date.
+// A file without a modification time has neither, so a client resuming it with If-Range gets the whole file.
+bool ifRangeMatches(uint32_t size, uint32_t modified) {
+    String ifRange = server.header("If-Range");
+    ifRange.trim();
+    if (ifRange.length() == 0) return true;
+    if (modified == 0) return false;
+    if (ifRange.startsWith("\"")) return ifRange == makeETag(size, modified);
+    return fatFromHttpDate(ifRange) == modified;
+}
+
+// Looks at the request's Range header for a file of size bytes and sets offset/length of the part to send.
+// Returns the status to answer with: 200 (whole file; also for missing, multi-range or malformed headers,
+// and when If-Range names an older version of the file), 206 (partial) or 416 (the range lies past the end
+// of the file, or the file is empty).
+int parseRangeHeader(uint32_t size, uint32_t modified, uint32_t& offset, uint32_t& length) {
+    offset = 0;
+    length = size;
+    String range = server.header("Range");
+    if (range.length() > 0 && !ifRangeMatches(size, modified)) return 200;
+    if (!range.startsWith("bytes=") || range.indexOf(',') >= 0) return 200;
+    if (size == 0) return 416;  // an empty file has no byte to send, and size - 1 below would wrap
+    int dash = range.indexOf('-');
+    if (dash < 0) return 200;
+    String firstStr = range.substring(6, dash);
+    String lastStr = range.substring(dash + 1);
+    firstStr.trim();
+    lastStr.trim();
+
+    uint32_t first = 0;
+    uint32_t last = size - 1;
+    if (firstStr.length() == 0) {  // "bytes=-N": the last N bytes
+        uint32_t suffix;
+        if (!parseRangeNumber(lastStr, suffix)) return 200;
+        if (suffix == 0) return 416;
+        if (suffix < size) first = size - suffix;
+    } else {
+        if (!parseRangeNumber(firstStr, first)) return 200;
+        if (lastStr.length() > 0) {
+            if (!parseRangeNumber(lastStr, last) || last < first) return 200;
+            if (last >= size) last = size - 1;
+        }
+        if (first >= size) return 416;
+    }
+    offset = first;
+    length = last - first + 1;
+    return 206;
+}
+
+// Sends the status line and headers of a file response (status from parseRangeHeader()). For 416 the
+// complete error response is sent.
+void sendFileHeaders(int status, const String& dataType, uint32_t size, uint32_t modified, bool gzip, uint32_t offset, uint32_t length) {
+    server.sendHeader("Accept-Ranges", "bytes");
+    if (status == 416) {
+        server.sendHeader("Content-Range", "bytes */" + String(size));
+        server.send(416, "text/plain", "Range Not Satisfiable");
+        return;
+    }
+    sendValidatorHeaders(dataType, size, modified, gzip);
+    if (gzip) server.sendHeader("Content-Encoding", "gzip");
+    if (status == 206) {
+        server.sendHeader("Content-Range", "bytes " + String(offset) + "-" + String(offset + length - 1) + "/" + String(size));
+    }
+    server.setContentLength(length);
+    server.send(status, dataType, "");
+}
+
+// --- Background file transfers ---
+// loadFromI2CSD() checks the file and sends the headers, then hands the body to an SDTransfer, queued on the bus
+// scheduler (SDBus.h) as a job that reads one bounded slice per step. Other requests are served between slices
+// instead of waiting for (or being refused during) a long download; small files are queued as interactive and
+// overtake bulk downloads.
+// The body is read through the transfer's SDFileReader. Another request may use the bridge between two slices, so
+// the reader selects the file again ('F') and continues from its position ('O') whenever that has happened.
+//
+// Within a slice the 32-byte I2C chunks are staged into TCP segments of one MSS instead of one tiny segment
+// per chunk. The stage holds two segments: a full one is written as soon as the send buffer has room for it,
+// otherwise the bus keeps filling the second one. Writes never block; a slow client just gets fewer slices.
+#define SD_DOWNLOAD_SEGMENT 1460      // TCP MSS
+#define SD_TRANSFER_SLICE 2920        // most file bytes read from the bridge in one slice
+#define SD_MAX_TRANSFERS 3            // concurrent downloads, further ones are answered with 503
+#define SD_TRANSFER_TIMEOUT 10000     // ms without progress before a stalled client is dropped
+
+struct SDTransfer {
+    WiFiClient client;                // our copy keeps the connection open after the handler has returned
+    SDFileReader file;                // positioned at the next file offset to read
+    uint32_t modified;
+    uint32_t remaining;               // bytes still to read from the card
+    std::vector<uint8_t> stage;       // 2 * SD_DOWNLOAD_SEGMENT
+    size_t staged;
+    bool caching;                     // keep a copy for the RAM file cache
+    uint32_t cacheGeneration;         // sdFileCacheGeneration when the transfer started
+    std::vector<uint8_t> cacheFill;
+    uint32_t busUs;
+    uint32_t netUs;
+    uint32_t lastProgress;            // millis() of the last byte read or written
+    bool failed;
+};
+
+uint32_t sdDownloadBusUs = 0;  // last download: time spent reading from the bridge
+uint32_t sdDownloadNetUs = 0;  // last download: time spent handing data to the TCP stack
+
+// Writes staged segments as long as the client has room for them. Returns false if the client is gone.
+bool sdTransferFlush(SDTransfer& t) {
+    while (t.staged > 0) {
+        size_t segment = min(t.staged, (size_t)SD_DOWNLOAD_SEGMENT);
+        if (segment < SD_DOWNLOAD_SEGMENT && t.remaining > 0) return true;  // wait for a full segment
+        if (!t.client.connected()) return false;
+        if (t.client.availableForWrite() < (int)segment) return true;
+        uint32_t started = micros();
+        size_t written = t.client.write(t.stage.data(), segment);
+        t.netUs += micros() - started;
+        if (written != segment) return false;
+        t.staged -= segment;
+        memmove(t.stage.data(), t.stage.data() + segment, t.staged);
+        t.lastProgress = millis();
+    }
+    return true;
+}
+
+// Reads up to SD_TRANSFER_SLICE bytes of the file into the stage, handing segments to TCP on the way.
+// Returns false on an I2C error.
+bool sdTransferRead(SDTransfer& t) {
+    if (t.staged + SD_READ_CHUNK_MAX > t.stage.size()) return true;  // stage full, the client has to catch up first
+
+    sdClockUse(SD_CLOCK_DOWNLOAD);
+    bool ok = true;
+    uint32_t sliceLeft = SD_TRANSFER_SLICE;
+    while (t.remaining > 0 && sliceLeft > 0 && t.staged + SD_READ_CHUNK_MAX <= t.stage.size()) {
+        // Read up to the end of the segment being filled, so it can go to TCP right away
+        size_t want = min(min(t.remaining, sliceLeft), (uint32_t)(SD_DOWNLOAD_SEGMENT - t.staged % SD_DOWNLOAD_SEGMENT));
+        uint32_t started = micros();
+        uint8_t* piece = t.stage.data() + t.staged;
+        size_t got = t.file.read(piece, want);
+        t.busUs += micros() - started;
+        if (t.caching) t.cacheFill.insert(t.cacheFill.end(), piece, piece + got);
+        t.staged += got;
+        t.remaining -= got;
+        sliceLeft = sliceLeft > got ? sliceLeft - got : 0;
+        if (got != want) {
+            ok = false;  // the reader has printed the offset
+            break;
+        }
+        t.lastProgress = millis();
+
+        if (!sdTransferFlush(t)) break;  // the next slice notices the closed connection
+        yield(); // Allow TCP stack to process
+    }
+    sdClockUse(SD_CLOCK_CONTROL); //back to default
+    return ok;
+}
+
+// Advances one transfer by one slice. Returns false once it is finished (or failed) and can be removed.
+bool sdTransferStep(SDTransfer& t) {
+    if (!sdTransferFlush(t)) t.failed = true;
+    if (!t.failed && t.remaining > 0 && !sdTransferRead(t)) t.failed = true;
+    if (!t.failed && !sdTransferFlush(t)) t.failed = true;
+    if (!t.failed && millis() - t.lastProgress > SD_TRANSFER_TIMEOUT) {
+        Serial.println("\nError: client stalled, dropping download.");
+        t.failed = true;
+    }
+    if (!t.failed && (t.remaining > 0 || t.staged > 0)) return true;
+
+    t.client.stop();  // also cuts a failed response short, so the client sees it is incomplete
+    sdDownloadBusUs = t.busUs;
+    sdDownloadNetUs = t.netUs;
+    Serial.print("Served ");
+    Serial.print(t.file.path());
+    Serial.print(t.failed ? " (aborted), bus " : ", bus ");
+    Serial.print(t.busUs / 1000);
+    Serial.print(" ms, network ");
+    Serial.print(t.netUs / 1000);
+    Serial.println(" ms");
+    if (!t.failed && t.caching && t.cacheFill.size() == t.file.size()) {
+        sdFileCacheInsert(t.file.path(), t.modified, std::move(t.cacheFill), t.cacheGeneration);
+    }
+    return false;
+}
+
+// Opens a file to serve with one 'I' round trip (see sdStat()), which doubles as the check that the bridge answers
+bool sdServeOpen(SDFileReader& file, const String& path) {
+    if (file.open(path.c_str())) {
+        Detected_i2cSDCard = true;
+        return true;
+    }
+    if (++i2cSDCarderrcnt > 5) Detected_i2cSDCard = false;
+    return false;
+}
+
 bool loadFromI2CSD(const String& filename) {
     /*
-    - The function now uses WiFiClient client = server.client(); to get the underlying TCP connection and explicitly flushes and closes it after sending all data.
-    - yield() and CustDelay(1) are used between chunks to allow the ESP8266's networking stack to process outgoing data, which is crucial for large files.
-    - The function returns false if any error occurs during chunk sending, ensuring the browser gets a proper connection close.
+    - The function checks the file and sends the response headers; the body is streamed by an SDTransfer that the bus scheduler (sdBusRun() from loop()) advances a bounded slice at a time, so other clients are served in between. Up to SD_MAX_TRANSFERS downloads run at once, further ones get a 503.
+    - The transfer keeps its own copy of server.client(), which holds the connection open, and closes it when the last byte has been handed to TCP.
+    - Returns false only if the file could not be found or opened (the caller then sends the 404 page).
+    - Files up to sdFileCacheMaxFile bytes are kept in the RAM cache (SDFileCache.h) and repeat hits are served from there.
+    - Responses carry an ETag and Last-Modified built from the size and the bridge's modification time; a matching If-None-Match / If-Modified-Since is answered with 304 before any 'R' transfer.
+    - If the client accepts gzip and file.ext.gz exists next to the file, that is sent instead, with Content-Encoding: gzip and the MIME type of file.ext.
+    - A "Range: bytes=" request header is answered with 206 and only the requested part, read from the bridge with 'O' (seek), so interrupted downloads can resume. With an If-Range header the range is only sent if it names the current ETag or Last-Modified; otherwise the whole file is sent with 200.
+    - The file is read through an SDFileReader, opened here and handed to the transfer. With bridge firmware that supports 'I' the open is a single round trip that also tells whether the file exists, its size and modification time.
     */
     String workingFilename = filename;  // Create a mutable copy
     if (workingFilename.endsWith("/")) workingFilename += "index.htm";
@@ -1102,19 +1571,8 @@ bool loadFromI2CSD(const String& filename) {
         workingFilename = workingFilename.substring(0, workingFilename.lastIndexOf("apple-touch-icon-precomposed.png")) + "apple-touch-icon.png";
     }
 
-    Wire.beginTransmission(I2C_SDCARD);
-    byte errorsd = Wire.endTransmission();
-    if (errorsd == 0) {
-        Detected_i2cSDCard = true;
-    } else {
-        if (i2cSDCarderrcnt > 5) {
-            Detected_i2cSDCard = false;
-            return false;
-        }
-        i2cSDCarderrcnt++;
-    }
     if (workingFilename.length() == 0) return false;
-    if (!checkExists(workingFilename.c_str(), false)) return false;
+    String existsFilename = workingFilename;  // .src files are checked under their own name but read without the extension
     String dataType = "";
     if (workingFilename.endsWith(".src")) workingFilename = workingFilename.substring(0, workingFilename.lastIndexOf("."));
     else if (workingFilename.endsWith(".htm")) dataType = F("text/html");
@@ -1134,126 +1592,173 @@ bool loadFromI2CSD(const String& filename) {
     else dataType = F("application/octet-stream");  //no match above the file will just download
     if (server.hasArg("download")) dataType = F("application/octet-stream");
 
-    Wire.beginTransmission(I2C_SDCARD);
-    Wire.write('F');
-    const char* name = workingFilename.c_str();
-    if (strlen(name) < 31) {
-        Wire.write(name, strlen(name));
-    } else {
-        while (*name) Wire.write(*name++);
+    // Text assets may have a pre-compressed sibling (file.ext.gz), sent instead when the client takes gzip
+    bool gzip = false;
+    bool tryGzip = !workingFilename.endsWith(".gz") && acceptsGzip();
+    String gzipFilename = workingFilename + ".gz";
+
+    // Repeat hits on small files are answered from RAM without touching the bridge
+    const SDCachedFile* cached = tryGzip ? sdFileCacheLookup(gzipFilename, false) : nullptr;
+    if (cached) gzip = true;
+    else cached = sdFileCacheLookup(workingFilename);
+    if (cached) {
+        if (sendNotModified(dataType, cached->data.size(), cached->modified, gzip)) return true;
+        uint32_t offset, length;
+        int status = parseRangeHeader(cached->data.size(), cached->modified, offset, length);
+        sendFileHeaders(status, dataType, cached->data.size(), cached->modified, gzip, offset, length);
+        if (status != 416) server.sendContent((const char*)cached->data.data() + offset, length);
+        return true;
     }
-    uint8_t error = Wire.endTransmission();
-    if (error != 0) {
-        Serial.print("I2C Error sending filename for read: ");
-        Serial.println(error);
-        i2cSDCarderrcnt++;
-        return false;
-    }
-    //CustDelay(5);
-    Wire.endTransmission(false);
 
-    // Get File Size
-    Wire.beginTransmission(I2C_SDCARD);
-    Wire.write('S');
-    error = Wire.endTransmission(false);
-    if (error != 0) {
-        Serial.print("I2C Error sending 'S' command: ");
-        Serial.println(error);
-        i2cSDCarderrcnt++;
-        return false;
+    SDBusOp busOp(SD_OP_READ);
+    SDFileReader file;
+    if (tryGzip && sdDirCacheHasFile(gzipFilename.c_str()) != 0) {
+        if (!sdServeOpen(file, gzipFilename)) return false;
+        if (file.exists()) {
+            workingFilename = gzipFilename;
+            existsFilename = gzipFilename;
+            gzip = true;
+        }
     }
-    //CustDelay(5);
-    uint32_t size = 0;
-    uint8_t bytesRead = Wire.requestFrom(I2C_SDCARD, 4, 1);
-    if (bytesRead == 4) {
-        for (int i = 0; i < 4; i++) size = (size << 8) | Wire.read();
-    } else {
-        Serial.print("Error reading size, expected 4 bytes, got ");
-        Serial.println(bytesRead);
-        while (Wire.available()) Wire.read();
-        return false;
+    if (!gzip) {
+        if (existsFilename != workingFilename && !checkExists(existsFilename.c_str(), false)) return false;
+        if (!sdServeOpen(file, workingFilename) || !file.exists()) return false;
     }
+    uint32_t size = file.size();
     if (size == 0) {
         Serial.println("File is empty or not found.");
         return false;
     }
-    Wire.setClock(i2c_bus_FileDownload); //lets speed up the transfer
-    CustDelay(5);
-    Wire.beginTransmission(I2C_SDCARD);
-    Wire.endTransmission();
-    CustDelay(5);
-
-    // Send Read Command
-    Wire.beginTransmission(I2C_SDCARD);
-    Wire.write('R');
-    error = Wire.endTransmission(false);
-    if (error != 0) {
-        Serial.print("I2C Error sending file read Command!!! Error code: ");
-        Serial.println(error);
-        i2cSDCarderrcnt++;
-        return false;
+    uint32_t modified = file.modified();
+    if (sendNotModified(dataType, size, modified, gzip)) return true;  // the browser's copy is current, skip the transfer
+    uint32_t offset, length;
+    int status = parseRangeHeader(size, modified, offset, length);
+    if (status == 416) {
+        sendFileHeaders(status, dataType, size, modified, gzip, offset, length);
+        return true;
     }
-
-    // Start chunked response
-    server.setContentLength(size);
-    server.send(200, dataType, "");  // Send headers first
-
-    const int readChunkSize = 32;
-    uint32_t bytesRemaining = size;
-    char buffer[readChunkSize];
-    SDCARDBUSY = true;
-
-    WiFiClient client = server.client();
-    bool errorDuringSend = false;
-
-    while (bytesRemaining > 0) {
-        int bytesToRequest = min((int)bytesRemaining, readChunkSize);
-        bytesRead = Wire.requestFrom(I2C_SDCARD, bytesToRequest, 0);
-        if (bytesRead > 0) {
-            for (int i = 0; i < bytesRead; i++) {
-                if (Wire.available()) {
-                    buffer[i] = Wire.read();
-                } else {
-                    Serial.println("\nError: Wire not available during read chunk.");
-                    Wire.endTransmission();
-                    errorDuringSend = true;
-                    break;
-                }
-            }
-            if (errorDuringSend) break;
-            server.sendContent(buffer, bytesRead);
-            yield(); // Allow TCP stack to process
-            bytesRemaining -= bytesRead;
-        } else {
-            Serial.print("\nError reading file chunk, expected ");
-            Serial.print(bytesToRequest);
-            Serial.println(" bytes, got 0.");
-            Wire.endTransmission();
-            errorDuringSend = true;
-            break;
-        }
-        //CustDelay(1); // Small delay to allow WiFi stack to process
+    if (sdBusQueued(SD_OP_READ) >= SD_MAX_TRANSFERS) {
+        sdBusStats.rejected++;
+        server.sendHeader("Retry-After", "2");
+        server.send(503, "text/plain", "Too many downloads in progress, try again shortly");
+        return true;
     }
-    Wire.endTransmission();  // Send STOP after the last chunk is read
 
-    // Final empty chunk to signal end of response
-    server.sendContent("");
-    CustDelay(5);
-
-    // Explicitly flush and close the connection if possible
-    if (client && client.connected()) {
-        client.flush();
-        CustDelay(3);
-        client.stop();
+    sendFileHeaders(status, dataType, size, modified, gzip, offset, length);  // Send headers first
+
+    // The body is read by bus scheduler steps from loop(); the first slice runs right away
+    std::shared_ptr<SDTransfer> transfer = std::make_shared<SDTransfer>();
+    SDTransfer& t = *transfer;
+    t.client = server.client();
+    t.file = file;
+    t.file.seek(offset);
+    t.modified = modified;
+    t.remaining = length;
+    t.stage.resize(2 * SD_DOWNLOAD_SEGMENT);
+    t.staged = 0;
+    t.caching = length == size && sdFileCacheMakeRoom(size);  // keep a copy of small files so the next request can skip the bus
+    if (t.caching) t.cacheFill.reserve(size);
+    t.cacheGeneration = sdFileCacheGeneration;
+    t.busUs = 0;
+    t.netUs = 0;
+    t.lastProgress = millis();
+    t.failed = false;
+    if (sdTransferStep(t)) {
+        sdBusEnqueue(length <= sdBusInteractiveMaxBytes ? SD_BUS_INTERACTIVE : SD_BUS_BULK, SD_OP_READ,
+                     [transfer]() { return sdTransferStep(*transfer); }, transfer->file.path().c_str());
     }
+    return true;
+}
 
-    Wire.setClock(i2c_bus_Clock); //back to default
-    CustDelay(5);
-    Wire.beginTransmission(I2C_SDCARD);
-    Wire.endTransmission();
-    SDCARDBUSY = false;
+// --- I2C transaction trace ---
+void handleTrace() {
+    if (server.hasArg("start")) {
+        uint32_t records;
+        if (!parseRangeNumber(server.arg("start"), records)) {
+            server.send(400, "text/plain", "start must be a number of records, 0 to " + String(SD_TRACE_MAX_RECORDS));
+            return;
+        }
+        sdTraceBegin(records > SD_TRACE_MAX_RECORDS ? SD_TRACE_MAX_RECORDS : records);
+    }
+    if (server.arg("stop") == "1") sdTraceBegin(0);
+    ChunkedResponse out;
+    if (server.arg("format") == "bin") {
+        out.begin(200, "application/octet-stream");
+        sdTraceWrite(out);
+    } else {
+        out.begin(200, "text/plain");
+        sdTracePrint(out);
+    }
+    out.end();
+}
 
-    return !errorDuringSend;
+// --- Prometheus metrics ---
+void handleMetrics() {
+    static const char* const priorityNames[SD_BUS_PRIORITIES] = { "interactive", "bulk" };
+    ChunkedResponse out;
+    out.begin(200, "text/plain; version=0.0.4");
+    sdMetricsPrint(out);
+
+    sdPromHeader(out, "sd_bus_queue_depth", "gauge", "Queued bus jobs");
+    sdPromValue(out, "sd_bus_queue_depth", nullptr, nullptr, sdBusQueue.size());
+    sdPromHeader(out, "sd_bus_queue_depth_max", "gauge", "Most bus jobs queued at once");
+    sdPromValue(out, "sd_bus_queue_depth_max", nullptr, nullptr, sdBusStats.maxDepth);
+    sdPromHeader(out, "sd_bus_rejected_total", "counter", "Downloads refused with 503 because too many were in progress");
+    sdPromValue(out, "sd_bus_rejected_total", nullptr, nullptr, sdBusStats.rejected);
+    sdPromHeader(out, "sd_bus_aged_steps_total", "counter", "Bulk steps run ahead of interactive ones because they waited too long");
+    sdPromValue(out, "sd_bus_aged_steps_total", nullptr, nullptr, sdBusStats.aged);
+    sdPromHeader(out, "sd_bus_jobs_total", "counter", "Bus jobs queued");
+    for (uint8_t p = 0; p < SD_BUS_PRIORITIES; p++) sdPromValue(out, "sd_bus_jobs_total", "priority", priorityNames[p], sdBusStats.jobs[p]);
+    sdPromHeader(out, "sd_bus_steps_total", "counter", "Bus job steps run");
+    for (uint8_t p = 0; p < SD_BUS_PRIORITIES; p++) sdPromValue(out, "sd_bus_steps_total", "priority", priorityNames[p], sdBusStats.steps[p]);
+    sdPromHeader(out, "sd_bus_wait_seconds_total", "counter", "Time bus job steps waited for the bus");
+    for (uint8_t p = 0; p < SD_BUS_PRIORITIES; p++) sdPromValue(out, "sd_bus_wait_seconds_total", "priority", priorityNames[p], sdBusStats.waitUs[p] / 1e6);
+    sdPromHeader(out, "sd_bus_wait_seconds_max", "gauge", "Longest wait of a bus job step");
+    for (uint8_t p = 0; p < SD_BUS_PRIORITIES; p++) sdPromValue(out, "sd_bus_wait_seconds_max", "priority", priorityNames[p], sdBusStats.maxWaitUs[p] / 1e6);
+    sdPromHeader(out, "sd_bus_ops_total", "counter", "Bus operations run by request handlers");
+    for (uint8_t k = 0; k < SD_OP_KINDS; k++) sdPromValue(out, "sd_bus_ops_total", "kind", sdBusOpNames[k], sdBusStats.ops[k]);
+    sdPromHeader(out, "sd_bus_busy_seconds_total", "counter", "Time request handler operations held the bus");
+    for (uint8_t k = 0; k < SD_OP_KINDS; k++) sdPromValue(out, "sd_bus_busy_seconds_total", "kind", sdBusOpNames[k], sdBusStats.opUs[k] / 1e6);
+
+    sdClockInit();
+    sdPromHeader(out, "sd_clock_hz", "gauge", "Current I2C clock of each operation class");
+    for (uint8_t c = 0; c < SD_CLOCK_CLASSES; c++) sdPromValue(out, "sd_clock_hz", "class", sdClockClassNames[c], *sdClockSetting[c]);
+    sdPromHeader(out, "sd_clock_ceiling_hz", "gauge", "Fastest clean I2C clock found by the boot probe");
+    for (uint8_t c = 0; c < SD_CLOCK_CLASSES; c++) sdPromValue(out, "sd_clock_ceiling_hz", "class", sdClockClassNames[c], sdClockSteps[sdClockState[c].ceiling]);
+    sdPromHeader(out, "sd_clock_errors_total", "counter", "I2C errors charged to each operation class");
+    for (uint8_t c = 0; c < SD_CLOCK_CLASSES; c++) sdPromValue(out, "sd_clock_errors_total", "class", sdClockClassNames[c], sdClockState[c].errors);
+    sdPromHeader(out, "sd_clock_step_downs_total", "counter", "Clock reductions after errors");
+    for (uint8_t c = 0; c < SD_CLOCK_CLASSES; c++) sdPromValue(out, "sd_clock_step_downs_total", "class", sdClockClassNames[c], sdClockState[c].stepDowns);
+    sdPromHeader(out, "sd_clock_step_ups_total", "counter", "Clock increases after quiet periods");
+    for (uint8_t c = 0; c < SD_CLOCK_CLASSES; c++) sdPromValue(out, "sd_clock_step_ups_total", "class", sdClockClassNames[c], sdClockState[c].stepUps);
+
+    sdPromHeader(out, "sd_read_checked", "gauge", "1 if file reads are CRC-checked ('G')");
+    sdPromValue(out, "sd_read_checked", nullptr, nullptr, sdReadChecked ? 1 : 0);
+    sdPromHeader(out, "sd_read_retries_total", "counter", "Read frames requested again");
+    sdPromValue(out, "sd_read_retries_total", nullptr, nullptr, sdReadStats.retries);
+
+    sdPromHeader(out, "sd_cache_hits_total", "counter", "RAM cache hits");
+    sdPromValue(out, "sd_cache_hits_total", "cache", "file", sdFileCacheHits);
+    sdPromValue(out, "sd_cache_hits_total", "cache", "dir", sdDirCacheHits);
+    sdPromHeader(out, "sd_cache_misses_total", "counter", "RAM cache misses");
+    sdPromValue(out, "sd_cache_misses_total", "cache", "file", sdFileCacheMisses);
+    sdPromValue(out, "sd_cache_misses_total", "cache", "dir", sdDirCacheMisses);
+    sdPromHeader(out, "sd_cache_bytes", "gauge", "Bytes held by the RAM caches");
+    sdPromValue(out, "sd_cache_bytes", "cache", "file", sdFileCacheBytes);
+    sdPromValue(out, "sd_cache_bytes", "cache", "dir", sdDirCacheBytes);
+
+    sdPromHeader(out, "sd_last_download_seconds", "gauge", "Time the last download spent on the bus and on the network");
+    sdPromValue(out, "sd_last_download_seconds", "part", "bus", sdDownloadBusUs / 1e6);
+    sdPromValue(out, "sd_last_download_seconds", "part", "net", sdDownloadNetUs / 1e6);
+    sdPromHeader(out, "sd_card_detected", "gauge", "1 while the bridge answers");
+    sdPromValue(out, "sd_card_detected", nullptr, nullptr, Detected_i2cSDCard ? 1 : 0);
+    sdPromHeader(out, "sd_card_error_count", "gauge", "Consecutive failures to reach the bridge");
+    sdPromValue(out, "sd_card_error_count", nullptr, nullptr, i2cSDCarderrcnt);
+    sdPromHeader(out, "heap_free_bytes", "gauge", "Free heap");
+    sdPromValue(out, "heap_free_bytes", nullptr, nullptr, ESP.getFreeHeap());
+    sdPromHeader(out, "heap_max_block_bytes", "gauge", "Largest free heap block");
+    sdPromValue(out, "heap_max_block_bytes", nullptr, nullptr, ESP.getMaxFreeBlockSize());
+    out.end();
 }
 
 void RunSDCard_Demo() {
@@ -1295,7 +1800,7 @@ void RunSDCard_Demo() {
 
   Serial.println();
   setSDCardTime(2024, 7, 26, 10, 30, 00); // Set a specific time
-  delay(100); // Give bridge time to process time set
+  sdWaitReady(); // Give bridge time to process time set
 
   mkdir("/NEST");      // Create parent first
   mkdir(nestedDir);    // Create nested dir
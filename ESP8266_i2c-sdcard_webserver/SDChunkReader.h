@@ -0,0 +1,212 @@
+/*
+
+- SDChunkReader::begin(uint32_t offset) Starts streaming the selected file at offset: 'G' + offset in checked mode, otherwise 'R' (offset 0) or 'O' + offset. Returns false on an I2C error; in checked mode a failed command is left to read() to retry.
+- SDChunkReader::read(uint8_t* dst, uint32_t remaining) Reads the next chunk into dst, at most SD_READ_CHUNK_MAX bytes and never more than remaining. Returns the number of bytes read, or 0 if the read failed (in checked mode only after SD_READ_RETRIES re-requests of the chunk).
+- SDChunkReader::end() Sends STOP after the last chunk.
+- sdProbeCommand(const uint8_t* cmd, size_t cmdLen, uint8_t* reply, size_t replyLen) Sends a command the bridge firmware may not know and reads replyLen bytes of its reply, for the start-up probes of optional commands. Returns true if the bridge answered.
+- sdReadProbeChecked() Called from setup(): turns on checked reads if i2c_bus_CheckedReads is set and the bridge answers 'G' with a valid frame.
+- sdReadPrintStats(Print& out) Writes the chunk, CRC error, retry and failure counts as plain text.
+
+In checked mode the bridge sends the file in frames of SD_READ_FRAME bytes, one per requestFrom(): 30 data bytes (0xFF
+past the end) followed by a CRC-16/CCITT over the frame's file offset (4 bytes, MSB first) and the data, MSB first.
+A frame that fails the check or comes back short is requested again with 'G' + its offset, so a bad chunk costs one
+retry instead of the whole download; covering the offset also catches a frame the bridge skipped. Every failure is
+charged to the clock of the operation (sdClockError()), so a bus that keeps corrupting frames is slowed down, and
+counted in sdMetrics as an SD_METRIC_READ error; every read() is one SD_METRIC_READ call.
+Bridge firmware without 'G' leaves reads unchecked, as before: a short chunk fails the read and bit errors go unseen.
+
+*/
+
+#define SD_READ_FRAME 32                       // bytes per checked frame, one requestFrom()
+#define SD_READ_FRAME_DATA (SD_READ_FRAME - 2)  // file bytes in a frame
+#define SD_READ_CHUNK_MAX 32                   // most bytes read() returns, in either mode
+#define SD_READ_RETRIES 4                      // re-requests of one frame before the read fails
+
+#if defined(BUFFER_LENGTH) && SD_READ_FRAME > BUFFER_LENGTH
+#error "SD_READ_FRAME must not exceed Wire's BUFFER_LENGTH"
+#endif
+
+bool sdReadChecked = false;  // the bridge supports 'G', set by sdReadProbeChecked()
+
+struct SDReadStats {
+  uint32_t chunks = 0;      // chunks delivered
+  uint32_t crcErrors = 0;   // frames that failed the check
+  uint32_t shortReads = 0;  // frames that came back short or NACKed
+  uint32_t retries = 0;     // frames requested again
+  uint32_t failures = 0;    // reads given up on
+};
+
+SDReadStats sdReadStats;
+
+uint16_t sdCrc16(uint16_t crc, const uint8_t* data, size_t len) {
+  while (len--) {
+    crc ^= (uint16_t)*data++ << 8;
+    for (int i = 0; i < 8; i++) crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+bool sdFrameValid(const uint8_t* frame, uint32_t offset) {
+  uint8_t offsetBytes[4] = { (uint8_t)(offset >> 24), (uint8_t)(offset >> 16), (uint8_t)(offset >> 8), (uint8_t)offset };
+  uint16_t crc = sdCrc16(sdCrc16(0xFFFF, offsetBytes, 4), frame, SD_READ_FRAME_DATA);
+  return crc == (((uint16_t)frame[SD_READ_FRAME_DATA] << 8) | frame[SD_READ_FRAME_DATA + 1]);
+}
+
+// Sends a read command with a 4-byte offset (MSB first), or a plain 'R'. Returns the I2C error code.
+uint8_t sdReadCommand(char command, uint32_t offset) {
+  sdWire.beginTransmission(I2C_SDCARD);
+  sdWire.write(command);
+  if (command != 'R') {
+    sdWire.write((uint8_t)(offset >> 24));
+    sdWire.write((uint8_t)(offset >> 16));
+    sdWire.write((uint8_t)(offset >> 8));
+    sdWire.write((uint8_t)offset);
+  }
+  return sdWire.endTransmission(false);  // Keep connection active for requestFrom
+}
+
+// Firmware that does not know a command ignores it and leaves the bus idling high, so every byte of the reply reads
+// 0xFF. A reply of nothing but 0xFF therefore means "not supported", as does an I2C error or a short reply; the caller
+// still checks that the reply makes sense for the command.
+bool sdProbeCommand(const uint8_t* cmd, size_t cmdLen, uint8_t* reply, size_t replyLen) {
+  sdWire.beginTransmission(I2C_SDCARD);
+  sdWire.write(cmd, cmdLen);
+  size_t got = 0;
+  if (sdWire.endTransmission(false) == 0 && sdWire.requestFrom(I2C_SDCARD, (int)replyLen, 1) == replyLen) {
+    while (got < replyLen && sdWire.available()) reply[got++] = sdWire.read();
+  }
+  while (sdWire.available()) sdWire.read();
+  if (got != replyLen) return false;
+  for (size_t i = 0; i < replyLen; i++) {
+    if (reply[i] != 0xFF) return true;
+  }
+  return false;
+}
+
+class SDChunkReader {
+  public:
+    bool begin(uint32_t offset) {
+      _offset = offset;
+      _checked = sdReadChecked;
+      uint8_t error = sdReadCommand(_checked ? 'G' : offset == 0 ? 'R' : 'O', offset);
+      if (error != 0) {
+        sdMetricsError(SD_METRIC_READ, error);
+        sdClockError();
+      }
+      if (_checked) {
+        _resend = error != 0;
+        return true;
+      }
+      return error == 0;
+    }
+
+    uint32_t read(uint8_t* dst, uint32_t remaining) {
+      if (remaining == 0) return 0;
+      SDMetric metric(SD_METRIC_READ);
+      uint32_t got = _checked ? readFrame(dst, remaining) : readPlain(dst, remaining);
+      if (got == 0) metric.fail();  // the causes are already counted
+      metric.bytes(got);
+      return got;
+    }
+
+    void end() {
+      sdWire.endTransmission();  // Send STOP
+    }
+
+  private:
+    uint32_t _offset = 0;
+    bool _checked = false;
+    bool _resend = false;  // the next frame has to be asked for with 'G' + offset first
+
+    uint32_t readPlain(uint8_t* dst, uint32_t remaining) {
+      int want = min(remaining, (uint32_t)SD_READ_CHUNK_MAX);
+      uint8_t bytesRead = sdWire.requestFrom(I2C_SDCARD, want, 0);  // Don't send STOP yet
+      uint32_t got = 0;
+      while (got < bytesRead && sdWire.available()) dst[got++] = sdWire.read();
+      if (got == 0 || got != bytesRead) {
+        sdReadStats.shortReads++;
+        sdReadStats.failures++;
+        sdMetricsError(SD_METRIC_READ, SD_ERR_SHORT_READ);
+        sdClockError();
+        return 0;
+      }
+      sdReadStats.chunks++;
+      _offset += got;
+      return got;
+    }
+
+    uint32_t readFrame(uint8_t* dst, uint32_t remaining) {
+      uint8_t frame[SD_READ_FRAME];
+      for (int attempt = 0; attempt <= SD_READ_RETRIES; attempt++) {
+        if (attempt > 0) {
+          sdReadStats.retries++;
+          yield();
+        }
+        if (_resend) {
+          uint8_t error = sdReadCommand('G', _offset);
+          if (error != 0) {
+            sdMetricsError(SD_METRIC_READ, error);
+            sdClockError();
+            continue;
+          }
+          _resend = false;
+        }
+        uint8_t bytesRead = sdWire.requestFrom(I2C_SDCARD, SD_READ_FRAME, 0);  // Don't send STOP yet
+        size_t got = 0;
+        while (got < bytesRead && got < sizeof(frame) && sdWire.available()) frame[got++] = sdWire.read();
+        _resend = true;  // unless the frame checks out, the bridge is no longer where we want it
+        if (got != sizeof(frame)) {
+          sdReadStats.shortReads++;
+          sdMetricsError(SD_METRIC_READ, SD_ERR_SHORT_READ);
+          sdClockError();
+          continue;
+        }
+        if (!sdFrameValid(frame, _offset)) {
+          sdReadStats.crcErrors++;
+          sdMetricsError(SD_METRIC_READ, SD_ERR_CRC);
+          sdClockError();
+          continue;
+        }
+        _resend = false;
+        uint32_t n = min(remaining, (uint32_t)SD_READ_FRAME_DATA);
+        memcpy(dst, frame, n);
+        _offset += SD_READ_FRAME_DATA;  // the bridge has moved on by a whole frame either way
+        sdReadStats.chunks++;
+        return n;
+      }
+      sdReadStats.failures++;
+      return 0;
+    }
+};
+
+void sdReadProbeChecked() {
+  sdReadChecked = false;
+  if (!i2c_bus_CheckedReads) return;
+  uint8_t frame[SD_READ_FRAME];
+  for (int attempt = 0; attempt < 3 && !sdReadChecked; attempt++) {
+    // Any path will do: with no file selected the bridge still sends valid frames of 0xFF
+    sdWire.beginTransmission(I2C_SDCARD);
+    sdWire.write('F');
+    sdWire.write("/");
+    if (sdWire.endTransmission() != 0) continue;
+    const uint8_t cmd[5] = { 'G', 0, 0, 0, 0 };
+    sdReadChecked = sdProbeCommand(cmd, sizeof(cmd), frame, sizeof(frame)) && sdFrameValid(frame, 0);
+  }
+  sdSelectedPath = "";  // selected without sendFilename()
+  Serial.println(sdReadChecked ? "Checked reads ('G') enabled" : "Bridge does not support checked reads, reading unchecked");
+}
+
+void sdReadPrintStats(Print& out) {
+  out.print(F("reads checked "));
+  out.print(sdReadChecked ? 1 : 0);
+  out.print(F(" chunks "));
+  out.print(sdReadStats.chunks);
+  out.print(F(" crc_errors "));
+  out.print(sdReadStats.crcErrors);
+  out.print(F(" short_reads "));
+  out.print(sdReadStats.shortReads);
+  out.print(F(" retries "));
+  out.print(sdReadStats.retries);
+  out.print(F(" failures "));
+  out.println(sdReadStats.failures);
+}
@@ -0,0 +1,256 @@
+/*
+
+- sdClockProbe() Called from setup() once the bridge answers. For each operation class it tries the clocks of sdClockSteps from i2c_bus_MaxClock down, and keeps the fastest one at which the class's probe workload returns exactly what it returned at 100 kHz, SD_CLOCK_PROBE_ROUNDS times in a row. That clock becomes the class's clock and its ceiling.
+- sdClockUse(uint8_t cls) Switches Wire to the current clock of an operation class (SD_CLOCK_CONTROL, SD_CLOCK_LIST, SD_CLOCK_DOWNLOAD) and makes it the class sdClockError() charges. A class that has been quiet for sdClockQuietMs is first stepped back up one clock, up to its ceiling.
+- sdClockError() Records an I2C error (NACK, short read, broken listing) against the class in use and forgets which path the bridge has selected. sdClockErrorLimit errors within sdClockErrorWindowMs step that class down one clock. Every failed transaction with the bridge reports here, most through sdI2CError() (SDCardFunc.h): selects, stat, exists, listings, reads, writes, deletes and the start-up queries alike.
+- sdClockPrintStats(Print& out) Writes the current clock, ceiling, error and step counts of each class as plain text.
+
+The live clocks are the sketch's i2c_bus_Clock (commands, stat, writes), i2c_bus_List (directory listings) and
+i2c_bus_FileDownload (file reads), so a value set by hand is still used as is; set i2c_bus_AutoClock to false to
+keep them fixed. How fast the bus runs cleanly depends on the pull-ups and wiring of each board, which is why the
+clocks are measured rather than hard-coded: the probes compare whole responses, so bit errors that would otherwise
+pass unnoticed (the bridge has no checksum) rule a clock out as well as NACKs do.
+
+*/
+#include <vector>
+
+enum SDClockClass : uint8_t { SD_CLOCK_CONTROL, SD_CLOCK_LIST, SD_CLOCK_DOWNLOAD, SD_CLOCK_CLASSES };
+const char* const sdClockClassNames[SD_CLOCK_CLASSES] = { "control", "list", "download" };
+uint32_t* const sdClockSetting[SD_CLOCK_CLASSES] = { &i2c_bus_Clock, &i2c_bus_List, &i2c_bus_FileDownload };
+
+const uint32_t sdClockSteps[] = { 100000, 400000, 1000000, 1700000 };  // the first one is the reference and the floor
+const uint8_t sdClockStepCount = sizeof(sdClockSteps) / sizeof(sdClockSteps[0]);
+
+#define SD_CLOCK_PROBE_ROUNDS 8      // clean repetitions a clock needs to pass
+#define SD_CLOCK_PROBE_ENTRIES 8     // directory entries read by the listing probe
+#define SD_CLOCK_PROBE_BYTES 512     // file bytes read by the download probe
+
+uint32_t sdClockErrorLimit = 3;         // errors within the window that step a class down
+uint32_t sdClockErrorWindowMs = 10000;
+uint32_t sdClockQuietMs = 60000;        // error-free time before a class steps back up
+
+struct SDClockState {
+  uint8_t ceiling = 0;        // index into sdClockSteps: fastest clean clock found by the probe
+  uint8_t windowErrors = 0;
+  uint32_t windowStart = 0;   // millis()
+  uint32_t lastChange = 0;    // millis() of the last error or step
+  uint32_t errors = 0;
+  uint32_t stepDowns = 0;
+  uint32_t stepUps = 0;
+};
+
+SDClockState sdClockState[SD_CLOCK_CLASSES];
+uint8_t sdClockActive = SD_CLOCK_CONTROL;
+bool sdClockReady = false;
+
+// Index of the fastest step not above hz
+uint8_t sdClockStepOf(uint32_t hz) {
+  uint8_t step = 0;
+  while (step + 1 < sdClockStepCount && sdClockSteps[step + 1] <= hz) step++;
+  return step;
+}
+
+// Until the probe has run, the configured clocks are the ceilings
+void sdClockInit() {
+  if (sdClockReady) return;
+  for (uint8_t c = 0; c < SD_CLOCK_CLASSES; c++) {
+    sdClockState[c].ceiling = sdClockStepOf(*sdClockSetting[c]);
+    sdClockState[c].lastChange = millis();
+  }
+  sdClockReady = true;
+}
+
+void sdClockSet(uint8_t cls, uint8_t step, const char* why) {
+  *sdClockSetting[cls] = sdClockSteps[step];
+  sdClockState[cls].lastChange = millis();
+  Serial.print("I2C clock for ");
+  Serial.print(sdClockClassNames[cls]);
+  Serial.print(" ");
+  Serial.print(why);
+  Serial.print(" to ");
+  Serial.print(sdClockSteps[step]);
+  Serial.println(" Hz");
+  if (cls == sdClockActive) sdWire.setClock(sdClockSteps[step]);
+}
+
+void sdClockUse(uint8_t cls) {
+  sdClockInit();
+  sdClockActive = cls;
+  SDClockState& s = sdClockState[cls];
+  uint8_t step = sdClockStepOf(*sdClockSetting[cls]);
+  if (i2c_bus_AutoClock && step < s.ceiling && millis() - s.lastChange > sdClockQuietMs) {
+    s.stepUps++;
+    sdClockSet(cls, step + 1, "raised");
+  }
+  sdWire.setClock(*sdClockSetting[cls]);
+}
+
+void sdClockError() {
+  sdClockInit();
+  sdSelectedPath = "";  // the command may not have arrived, or the bridge has reset
+  sdTraceMarkError();
+  SDClockState& s = sdClockState[sdClockActive];
+  uint32_t now = millis();
+  s.errors++;
+  s.lastChange = now;
+  if (now - s.windowStart > sdClockErrorWindowMs) {
+    s.windowStart = now;
+    s.windowErrors = 0;
+  }
+  if (++s.windowErrors < sdClockErrorLimit || !i2c_bus_AutoClock) return;
+  s.windowErrors = 0;
+  uint8_t step = sdClockStepOf(*sdClockSetting[sdClockActive]);
+  if (step == 0) return;  // already at the floor, nothing slower to try
+  s.stepDowns++;
+  sdClockSet(sdClockActive, step - 1, "lowered");
+}
+
+// --- Probe workloads, each a short version of what the class does in normal use ---
+
+bool sdClockProbeSelect(const char* path) {
+  sdWire.beginTransmission(I2C_SDCARD);
+  sdWire.write('F');
+  sdWire.write(path);
+  return sdWire.endTransmission() == 0;
+}
+
+bool sdClockProbeCommand(char command, size_t want, std::vector<uint8_t>& out) {
+  sdWire.beginTransmission(I2C_SDCARD);
+  sdWire.write(command);
+  if (sdWire.endTransmission(false) != 0) return false;
+  if (sdWire.requestFrom(I2C_SDCARD, (int)want, 1) != want) return false;
+  while (sdWire.available()) out.push_back(sdWire.read());
+  return true;
+}
+
+// Appends the first entries of the root directory to out, in the order and format they arrived in
+bool sdClockProbeList(std::vector<uint8_t>& out) {
+  if (!sdClockProbeSelect("/")) return false;
+  sdWire.beginTransmission(I2C_SDCARD);
+  sdWire.write('L');
+  if (sdWire.endTransmission(false) != 0) return false;
+  SDDirStream dir;
+  SDDirRecord entry;
+  dir.begin();
+  bool ok = true;
+  for (int i = 0; i < SD_CLOCK_PROBE_ENTRIES; i++) {
+    SDDirResult result = dir.next(entry);
+    if (result == SD_DIR_ERROR) ok = false;
+    if (result != SD_DIR_ENTRY) break;
+    out.push_back(entry.type);
+    out.insert(out.end(), entry.name, entry.name + strlen(entry.name) + 1);
+    for (int b = 0; b < 4; b++) out.push_back((uint8_t)(entry.size >> (8 * b)));
+  }
+  sdWire.endTransmission();  // Send STOP
+  return ok;
+}
+
+bool sdClockProbeRead(const char* path, uint32_t bytes, std::vector<uint8_t>& out) {
+  const int readChunkSize = 32;
+  if (!sdClockProbeSelect(path)) return false;
+  sdWire.beginTransmission(I2C_SDCARD);
+  sdWire.write('R');
+  if (sdWire.endTransmission(false) != 0) return false;
+  bool ok = true;
+  for (uint32_t done = 0; done < bytes && ok; done += readChunkSize) {
+    int want = min((int)(bytes - done), readChunkSize);
+    ok = sdWire.requestFrom(I2C_SDCARD, want, 0) == want;
+    while (sdWire.available()) out.push_back(sdWire.read());
+  }
+  sdWire.endTransmission();  // Send STOP
+  return ok;
+}
+
+// Runs the probe workload of a class once at the current clock. probeFile is a file to read for
+// SD_CLOCK_DOWNLOAD; without one the listing is used, which streams from the bridge just the same.
+bool sdClockProbeWorkload(uint8_t cls, const String& probeFile, uint32_t probeBytes, std::vector<uint8_t>& out) {
+  out.clear();
+  if (cls == SD_CLOCK_CONTROL) {
+    return sdClockProbeSelect("/") && sdClockProbeCommand('K', 1, out) && sdClockProbeCommand('V', 10, out) &&
+           sdClockProbeCommand('Q', 1, out);
+  }
+  if (cls == SD_CLOCK_DOWNLOAD && probeFile.length() > 0) {
+    return sdClockProbeRead(probeFile.c_str(), probeBytes, out);
+  }
+  return sdClockProbeList(out);
+}
+
+void sdClockProbe() {
+  sdClockInit();
+  String probeFile;
+  uint32_t probeBytes = 0;
+  std::vector<uint8_t> reference, response;
+  const uint8_t order[SD_CLOCK_CLASSES] = { SD_CLOCK_LIST, SD_CLOCK_DOWNLOAD, SD_CLOCK_CONTROL };  // the listing names the file to read
+  const uint8_t top = sdClockStepOf(i2c_bus_MaxClock);
+  Serial.print("Probing I2C clocks up to ");
+  Serial.print(sdClockSteps[top]);
+  Serial.println(" Hz");
+
+  for (uint8_t cls : order) {
+    sdWire.setClock(sdClockSteps[0]);
+    bool ok = sdClockProbeWorkload(cls, probeFile, probeBytes, reference) &&
+              sdClockProbeWorkload(cls, probeFile, probeBytes, response) && response == reference;
+    if (!ok) {
+      Serial.print("  ");
+      Serial.print(sdClockClassNames[cls]);
+      Serial.println(": no stable answer at the lowest clock, keeping the configured clock");
+      continue;
+    }
+    if (cls == SD_CLOCK_LIST) {
+      // First non-empty file of the root: Type, Name, '\0', Size (LSB first)
+      for (size_t i = 0; i < reference.size();) {
+        uint8_t type = reference[i];
+        const char* name = (const char*)&reference[i + 1];
+        size_t end = i + 1 + strlen(name) + 1;
+        uint32_t size = 0;
+        for (int b = 0; b < 4; b++) size |= (uint32_t)reference[end + b] << (8 * b);
+        if (type == 'F' && size > 0) {
+          probeFile = String("/") + name;
+          probeBytes = min(size, (uint32_t)SD_CLOCK_PROBE_BYTES);
+          break;
+        }
+        i = end + 4;
+      }
+    }
+
+    uint8_t step = top;
+    for (; step > 0; step--) {
+      sdWire.setClock(sdClockSteps[step]);
+      int round = 0;
+      while (round < SD_CLOCK_PROBE_ROUNDS && sdClockProbeWorkload(cls, probeFile, probeBytes, response) &&
+             response == reference) {
+        round++;
+        yield();
+      }
+      if (round == SD_CLOCK_PROBE_ROUNDS) break;
+    }
+    *sdClockSetting[cls] = sdClockSteps[step];
+    sdClockState[cls].ceiling = step;
+    sdClockState[cls].lastChange = millis();
+    Serial.print("  ");
+    Serial.print(sdClockClassNames[cls]);
+    Serial.print(": ");
+    Serial.print(sdClockSteps[step]);
+    Serial.println(" Hz");
+  }
+  sdSelectedPath = "";  // the probes select paths without going through sendFilename()
+  sdClockUse(SD_CLOCK_CONTROL);
+}
+
+void sdClockPrintStats(Print& out) {
+  sdClockInit();
+  for (uint8_t c = 0; c < SD_CLOCK_CLASSES; c++) {
+    out.print(F("clock "));
+    out.print(sdClockClassNames[c]);
+    out.print(F(" hz "));
+    out.print(*sdClockSetting[c]);
+    out.print(F(" ceiling_hz "));
+    out.print(sdClockSteps[sdClockState[c].ceiling]);
+    out.print(F(" errors "));
+    out.print(sdClockState[c].errors);
+    out.print(F(" step_downs "));
+    out.print(sdClockState[c].stepDowns);
+    out.print(F(" step_ups "));
+    out.println(sdClockState[c].stepUps);
+  }
+}
@@ -0,0 +1,129 @@
+/*
+
+- sdDirCacheLookup(const char* dirname) Returns the cached entries of dirname, or nullptr if the directory has to be read from the card. Marks the directory as most recently used.
+- sdDirCacheInsert(const char* dirname, std::vector<SDDirEntry>& entries, uint32_t generation) Moves a complete listing of dirname into the cache, evicting least recently used directories until it fits in sdDirCacheBudget. generation is sdDirCacheGeneration from when the listing started on the bridge; if anything has been invalidated since, the listing may be out of date and is not cached. Returns the cached entries, or nullptr (leaving entries untouched) if the listing is larger than the budget or out of date.
+- sdDirCacheHasFile(const char* path) Answers from the cache whether path is a file: 1 if it is listed in its cached parent directory, 0 if the parent is cached but does not list it, -1 if the parent is not cached. Does not touch the hit/miss counters or the LRU order.
+- sdDirCacheInvalidate(const char* path) Drops the cached listing of the directory that contains path. Called whenever a file or directory is created, written or removed.
+- sdDirCacheInvalidateTree(const char* dirname) Drops the cached listings of dirname and every directory below it. Called when a directory is removed.
+
+Listing a directory over the bridge costs a full 'L' scan; keeping the parsed entries lets listDirectory_HTML() page
+through a directory, and redraw it after handleDeleteFile(), with a single scan. Paths are compared case-insensitively.
+
+*/
+#include <vector>
+#include <utility>
+
+uint32_t sdDirCacheBudget = 6144;  // bytes of cached directory entries, 0 disables the cache
+
+struct SDDirEntry {
+  uint8_t type;   // 'F' or 'D'
+  String name;
+  uint32_t size;
+};
+
+struct SDCachedDir {
+  String path;    // lower case, no trailing '/' except for the root
+  std::vector<SDDirEntry> entries;
+  uint32_t bytes;
+  uint32_t lastUsed;
+};
+
+std::vector<SDCachedDir> sdDirCache;
+uint32_t sdDirCacheBytes = 0;
+uint32_t sdDirCacheTick = 0;
+uint32_t sdDirCacheHits = 0;
+uint32_t sdDirCacheMisses = 0;
+uint32_t sdDirCacheGeneration = 0;  // counts invalidations
+
+// Approximate RAM cost of one cached entry
+uint32_t sdDirEntryBytes(const SDDirEntry& e) {
+  return sizeof(SDDirEntry) + e.name.length() + 1;
+}
+
+String sdDirCacheKey(const char* dirname) {
+  String key = dirname;
+  key.toLowerCase();
+  if (key.length() == 0) key = "/";
+  while (key.length() > 1 && key.endsWith("/")) key.remove(key.length() - 1);
+  return key;
+}
+
+const std::vector<SDDirEntry>* sdDirCacheLookup(const char* dirname) {
+  String key = sdDirCacheKey(dirname);
+  for (auto& dir : sdDirCache) {
+    if (dir.path == key) {
+      dir.lastUsed = ++sdDirCacheTick;
+      sdDirCacheHits++;
+      return &dir.entries;
+    }
+  }
+  sdDirCacheMisses++;
+  return nullptr;
+}
+
+int sdDirCacheHasFile(const char* path) {
+  String key = sdDirCacheKey(path);
+  int lastSlash = key.lastIndexOf('/');
+  String parent = lastSlash <= 0 ? String("/") : key.substring(0, lastSlash);
+  String name = key.substring(lastSlash + 1);
+  for (const auto& dir : sdDirCache) {
+    if (dir.path != parent) continue;
+    for (const auto& e : dir.entries) {
+      if (e.type == 'F' && e.name.equalsIgnoreCase(name)) return 1;
+    }
+    return 0;
+  }
+  return -1;
+}
+
+void sdDirCacheEvict(size_t index) {
+  sdDirCacheBytes -= sdDirCache[index].bytes;
+  sdDirCache.erase(sdDirCache.begin() + index);
+}
+
+const std::vector<SDDirEntry>* sdDirCacheInsert(const char* dirname, std::vector<SDDirEntry>& entries, uint32_t generation) {
+  if (generation != sdDirCacheGeneration) return nullptr;  // the directory may have changed since the listing started
+  String key = sdDirCacheKey(dirname);
+  uint32_t bytes = sizeof(SDCachedDir) + key.length();
+  for (const auto& e : entries) bytes += sdDirEntryBytes(e);
+
+  for (size_t i = 0; i < sdDirCache.size(); i++) {
+    if (sdDirCache[i].path == key) {
+      sdDirCacheEvict(i);
+      break;
+    }
+  }
+  if (bytes > sdDirCacheBudget) return nullptr;
+  while (!sdDirCache.empty() && sdDirCacheBytes + bytes > sdDirCacheBudget) {
+    size_t oldest = 0;
+    for (size_t i = 1; i < sdDirCache.size(); i++) {
+      if (sdDirCache[i].lastUsed < sdDirCache[oldest].lastUsed) oldest = i;
+    }
+    sdDirCacheEvict(oldest);
+  }
+  sdDirCacheBytes += bytes;
+  sdDirCache.push_back({ key, std::move(entries), bytes, ++sdDirCacheTick });
+  return &sdDirCache.back().entries;
+}
+
+void sdDirCacheInvalidate(const char* path) {
+  sdDirCacheGeneration++;
+  String key = sdDirCacheKey(path);
+  int lastSlash = key.lastIndexOf('/');
+  String parent = lastSlash <= 0 ? String("/") : key.substring(0, lastSlash);
+  for (size_t i = 0; i < sdDirCache.size(); i++) {
+    if (sdDirCache[i].path == parent) {
+      sdDirCacheEvict(i);
+      return;
+    }
+  }
+}
+
+void sdDirCacheInvalidateTree(const char* dirname) {
+  sdDirCacheInvalidate(dirname);
+  String key = sdDirCacheKey(dirname);
+  String prefix = key.endsWith("/") ? key : key + "/";
+  for (size_t i = sdDirCache.size(); i-- > 0;) {
+    if (sdDirCache[i].path == key || sdDirCache[i].path.startsWith(prefix)) sdDirCacheEvict(i);
+  }
+}
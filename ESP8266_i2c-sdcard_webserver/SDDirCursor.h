@@ -0,0 +1,139 @@
+/*
+
+- sdDirSeek(const char* dirname, uint32_t index, SDMetric& metric) Positions the listing cursor on entry index of dirname (0 is the first). Continues the listing the cursor was parked on if it is at that entry of the same directory and nothing else has used the bus since; otherwise selects dirname and starts a new listing at index, with 'N' when the bridge supports it and with 'L' and reading past the entries before index when not. Call it inside the SDBusOp of the listing. Returns false on an I2C error, which fails metric.
+- sdDirNext(SDDirRecord& entry) Reads the entry at the cursor and moves past it. Returns SD_DIR_ENTRY, SD_DIR_END or SD_DIR_ERROR like SDDirStream::next().
+- sdDirPeek() Reads the entry at the cursor ahead without moving past it (the next sdDirNext() hands it out), to tell whether a page is the last one. Returns SD_DIR_ENTRY, SD_DIR_END or SD_DIR_ERROR.
+- sdDirPark(SDMetric& metric) Ends the listing transaction (STOP) and adds the bytes received since sdDirSeek() to metric. The bridge keeps its place in the listing, so the next page of the same directory continues from here.
+- sdDirIndex() Index of the entry at the cursor; after SD_DIR_END, the number of entries in the directory (unless the listing was started past its end with 'N').
+- sdDirSkipProbe() Called from setup(): turns on 'N' if the bridge answers it for the root directory like 'L'.
+
+'L' streams a directory from its first entry, so a listing page used to read everything before it, and stopped at
+128 entries so the scan stayed bounded. The cursor makes a page cost the entries it shows (plus the one read ahead)
+in bus traffic, whatever the size of the directory: following "Next" continues the stream where the previous page
+left it, and any other page starts one with 'N' + index (MSB first), for which the bridge walks the entries before
+index on the card without sending them. Bridge firmware without 'N' still gets the first, but has to send every
+entry before index for the second.
+
+*/
+
+struct SDDirCursor {
+  String path;            // directory listed, as passed to sdDirSeek()
+  uint32_t index = 0;     // entry the next sdDirNext() returns
+  uint32_t seqAt = 0;     // sdBusOpSeq when the cursor was parked
+  uint32_t bytesAt = 0;   // stream.bytes() at sdDirSeek()
+  uint32_t requestsAt = 0;
+  uint32_t cacheGeneration = 0; // sdDirCacheGeneration when the bridge started this listing, for sdDirCacheInsert()
+  bool streaming = false; // the bridge is sending path's listing from index on (after what stream has buffered)
+  bool ended = false;     // the end marker was reached: index is the number of entries
+  bool pending = false;   // ahead holds entry index, read by sdDirPeek()
+  SDDirRecord ahead;
+  SDDirStream stream;
+};
+
+SDDirCursor sdDirCursor;
+bool sdDirSkip = false;  // the bridge supports 'N', set by sdDirSkipProbe()
+
+uint32_t sdDirIndex() {
+  return sdDirCursor.index;
+}
+
+SDDirResult sdDirNext(SDDirRecord& entry) {
+  SDDirCursor& c = sdDirCursor;
+  if (c.pending) {
+    entry = c.ahead;
+    c.pending = false;
+    c.index++;
+    return SD_DIR_ENTRY;
+  }
+  if (c.ended) return SD_DIR_END;
+  if (!c.streaming) return SD_DIR_ERROR;
+  SDDirResult result = c.stream.next(entry);
+  if (result == SD_DIR_ENTRY) {
+    c.index++;
+  } else {
+    c.streaming = false;
+    c.ended = result == SD_DIR_END;
+  }
+  return result;
+}
+
+SDDirResult sdDirPeek() {
+  SDDirCursor& c = sdDirCursor;
+  if (c.pending) return SD_DIR_ENTRY;
+  SDDirResult result = sdDirNext(c.ahead);
+  if (result == SD_DIR_ENTRY) {
+    c.pending = true;
+    c.index--;
+  }
+  return result;
+}
+
+// Sends 'L', or 'N' + index, for the selected directory. Returns Wire's error code.
+uint8_t sdDirList(uint32_t index) {
+  sdWire.beginTransmission(I2C_SDCARD);
+  if (index > 0) {
+    uint8_t cmd[5] = { 'N', (uint8_t)(index >> 24), (uint8_t)(index >> 16), (uint8_t)(index >> 8), (uint8_t)index };
+    sdWire.write(cmd, sizeof(cmd));
+  } else {
+    sdWire.write('L');
+  }
+  return sdWire.endTransmission(false);  // Keep connection active for requestFrom
+}
+
+bool sdDirSeek(const char* dirname, uint32_t index, SDMetric& metric) {
+  SDDirCursor& c = sdDirCursor;
+  // The caller's SDBusOp is the only one since the cursor was parked: the bridge is still where it left it
+  bool current = (c.streaming || c.ended || c.pending) && sdBusOpSeq == c.seqAt + 1 && c.path == dirname;
+  if (!current || c.index > index || (sdDirSkip && c.index < index && !c.ended)) {
+    c.path = dirname;
+    c.streaming = false;
+    c.ended = false;
+    c.pending = false;
+    if (!sendFilename(dirname)) {
+      metric.fail();
+      return false;
+    }
+    uint32_t start = sdDirSkip ? index : 0;
+    sdClockUse(SD_CLOCK_LIST);
+    sdWaitReady();
+    uint8_t error = sdDirList(start);
+    if (error != 0) {
+      sdI2CError(metric, error);
+      sdClockUse(SD_CLOCK_CONTROL);
+      return false;
+    }
+    c.stream.begin();
+    c.cacheGeneration = sdDirCacheGeneration;
+    c.streaming = true;
+    c.index = start;
+  } else {
+    sdClockUse(SD_CLOCK_LIST);
+  }
+  c.bytesAt = c.stream.bytes();
+  c.requestsAt = c.stream.requests();
+
+  SDDirRecord skipped;
+  while (c.index < index && sdDirNext(skipped) == SD_DIR_ENTRY) {}
+  return true;
+}
+
+void sdDirPark(SDMetric& metric) {
+  SDDirCursor& c = sdDirCursor;
+  if (c.stream.requests() != c.requestsAt) sdWire.endTransmission();  // Send STOP; the bridge keeps its place
+  metric.bytes(c.stream.bytes() - c.bytesAt);
+  sdClockUse(SD_CLOCK_CONTROL);
+  c.seqAt = sdBusOpSeq;
+}
+
+void sdDirSkipProbe() {
+  SDBusOp busOp(SD_OP_LIST);
+  uint8_t listed[8];
+  uint8_t skipped[8];
+  sdDirSkip = false;
+  if (sendFilename("/") && sdQuery('L', nullptr, listed, sizeof(listed)) && (listed[0] == 'F' || listed[0] == 'D')) {
+    // 'N' from entry 0 must start the listing over exactly like 'L'
+    const uint8_t cmd[5] = { 'N', 0, 0, 0, 0 };
+    sdDirSkip = sdProbeCommand(cmd, sizeof(cmd), skipped, sizeof(skipped)) && memcmp(listed, skipped, sizeof(listed)) == 0;
+  }
+  Serial.println(sdDirSkip ? "Listing from an entry ('N') enabled" : "Bridge does not support 'N' (or the card root is empty), paging listings with 'L'");
+}
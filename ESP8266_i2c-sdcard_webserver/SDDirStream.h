@@ -0,0 +1,108 @@
+/*
+
+- SDDirStream::begin() Resets the reader. Call it right after the 'L' command has been sent.
+- SDDirStream::next(SDDirRecord& entry) Parses the next record of the listing. Returns SD_DIR_ENTRY with entry filled in, SD_DIR_END when the 0xFF end marker is reached, or SD_DIR_ERROR if the bridge stopped answering or sent something that is not a listing record.
+- SDDirStream::requests() Number of sdWire.requestFrom() calls made since begin().
+- SDDirStream::bytes() Number of bytes received since begin(), including any clocked out past the end marker.
+
+After 'L' the bridge streams the listing as one byte sequence: Type ('F' or 'D'), Name, '\0', Size (4 bytes, LSB first),
+repeated, then 0xFF. Reading it one requestFrom() per character pays a full address + ACK cycle for every byte of
+every name; SDDirStream instead pulls up to SD_DIR_READ_CHUNK bytes per request into a ring buffer and parses records
+out of it. Bytes read past the end marker are simply discarded. Names longer than the record buffer are truncated.
+
+*/
+
+#ifndef SD_DIR_READ_CHUNK
+#define SD_DIR_READ_CHUNK 32  // bytes per requestFrom(); a typical entry is ~17 bytes, and whatever follows
+                              // the 0xFF end marker is clocked out for nothing, so bigger is not always better
+#endif
+#if defined(BUFFER_LENGTH) && SD_DIR_READ_CHUNK > BUFFER_LENGTH
+#error "SD_DIR_READ_CHUNK must not exceed Wire's BUFFER_LENGTH"
+#endif
+
+#define SD_DIR_NAME_MAX 64   // bytes kept of each name, including the terminating '\0'
+#define SD_DIR_NAME_LIMIT 255 // longest name accepted before the stream is considered corrupt
+
+enum SDDirResult { SD_DIR_ENTRY, SD_DIR_END, SD_DIR_ERROR };
+
+struct SDDirRecord {
+  uint8_t type;                 // 'F' or 'D'
+  char name[SD_DIR_NAME_MAX];
+  uint32_t size;                // 0 for directories
+};
+
+class SDDirStream {
+  public:
+    void begin() {
+      head = 0;
+      count = 0;
+      requestCount = 0;
+      byteCount = 0;
+      failed = false;
+    }
+
+    SDDirResult next(SDDirRecord& entry) {
+      int type = readByte();
+      if (type < 0) return SD_DIR_ERROR;
+      if (type == 0xFF) return SD_DIR_END;
+      if (type != 'F' && type != 'D') return SD_DIR_ERROR;
+      entry.type = (uint8_t)type;
+
+      size_t nameLen = 0;
+      size_t nameTotal = 0;
+      while (true) {
+        int c = readByte();
+        if (c < 0) return SD_DIR_ERROR;
+        if (c == 0) break;
+        if (++nameTotal > SD_DIR_NAME_LIMIT) return SD_DIR_ERROR;
+        if (nameLen < sizeof(entry.name) - 1) entry.name[nameLen++] = (char)c;
+      }
+      entry.name[nameLen] = '\0';
+
+      entry.size = 0;
+      for (int i = 0; i < 4; i++) {
+        int b = readByte();
+        if (b < 0) return SD_DIR_ERROR;
+        entry.size |= (uint32_t)b << (8 * i);
+      }
+      if (entry.type == 'D') entry.size = 0;
+      return SD_DIR_ENTRY;
+    }
+
+    uint32_t requests() const { return requestCount; }
+    uint32_t bytes() const { return byteCount; }
+
+  private:
+    uint8_t ring[SD_DIR_READ_CHUNK];
+    size_t head = 0;   // index of the next unread byte
+    size_t count = 0;  // unread bytes in the ring
+    uint32_t requestCount = 0;
+    uint32_t byteCount = 0;
+    bool failed = false;
+
+    bool fill() {
+      if (failed) return false;
+      yield(); // Prevent watchdog reset on long listings
+      size_t want = sizeof(ring) - count;
+      uint8_t got = sdWire.requestFrom(I2C_SDCARD, (int)want, 0); // Keep the bus for the next request
+      requestCount++;
+      if (got == 0) {
+        failed = true;
+        return false;
+      }
+      for (uint8_t i = 0; i < got && sdWire.available(); i++) {
+        ring[(head + count) % sizeof(ring)] = sdWire.read();
+        count++;
+        byteCount++;
+      }
+      return count > 0;
+    }
+
+    int readByte() {
+      if (count == 0 && !fill()) return -1;
+      uint8_t b = ring[head];
+      head = (head + 1) % sizeof(ring);
+      count--;
+      return b;
+    }
+};
@@ -0,0 +1,96 @@
+/*
+
+- sdFileCacheLookup(const String& path, bool countMiss) Returns the cached copy of path, or nullptr if it is not cached. Marks the entry as most recently used and counts a hit, or a miss unless countMiss is false (for speculative lookups such as a .gz sibling).
+- sdFileCacheMakeRoom(uint32_t size) Returns true if a file of size bytes may be cached, evicting least recently used entries until it fits in sdFileCacheBudget. Returns false if the file is larger than sdFileCacheMaxFile or the heap is too low.
+- sdFileCacheInsert(const String& path, uint32_t modified, std::vector<uint8_t>&& data, uint32_t generation) Stores the complete contents of path and its FAT modification time (0 if unknown), replacing any older copy. generation is sdFileCacheGeneration from before the first byte of data was read: if anything has been invalidated since, the file may have changed under the read (a download runs in slices, with other requests in between), and nothing is stored. Call sdFileCacheMakeRoom() first.
+- sdFileCacheInvalidate(const char* path) Drops the cached copy of path, if any. Called by every function that writes or deletes a file.
+- sdFileCacheInvalidateDir(const char* dirname) Drops every cached file below dirname. Called when a directory is removed.
+
+Small static assets (index.htm, CSS, JS, favicon) are requested on every page view; keeping them in RAM lets
+loadFromI2CSD() answer repeat hits without touching the bridge. Paths are compared case-insensitively, like FAT.
+
+*/
+#include <vector>
+#include <utility>
+
+uint32_t sdFileCacheBudget = 10240;  // total bytes of file data kept in RAM, 0 disables the cache
+uint32_t sdFileCacheMaxFile = 4096;  // files larger than this are never cached
+const uint32_t sdFileCacheMinFreeHeap = 16384; // never let the cache push free heap below this
+
+struct SDCachedFile {
+  String path;
+  std::vector<uint8_t> data;
+  uint32_t modified;  // FAT date/time, for ETag/Last-Modified
+  uint32_t lastUsed;
+};
+
+std::vector<SDCachedFile> sdFileCache;
+uint32_t sdFileCacheBytes = 0;
+uint32_t sdFileCacheTick = 0;
+uint32_t sdFileCacheHits = 0;
+uint32_t sdFileCacheMisses = 0;
+uint32_t sdFileCacheGeneration = 0;  // counts invalidations
+
+const SDCachedFile* sdFileCacheLookup(const String& path, bool countMiss = true) {
+  for (auto& entry : sdFileCache) {
+    if (entry.path.equalsIgnoreCase(path)) {
+      entry.lastUsed = ++sdFileCacheTick;
+      sdFileCacheHits++;
+      return &entry;
+    }
+  }
+  if (countMiss) sdFileCacheMisses++;
+  return nullptr;
+}
+
+void sdFileCacheEvict(size_t index) {
+  sdFileCacheBytes -= sdFileCache[index].data.size();
+  sdFileCache.erase(sdFileCache.begin() + index);
+}
+
+bool sdFileCacheMakeRoom(uint32_t size) {
+  if (size == 0 || size > sdFileCacheMaxFile || size > sdFileCacheBudget) return false;
+  while (!sdFileCache.empty() && sdFileCacheBytes + size > sdFileCacheBudget) {
+    size_t oldest = 0;
+    for (size_t i = 1; i < sdFileCache.size(); i++) {
+      if (sdFileCache[i].lastUsed < sdFileCache[oldest].lastUsed) oldest = i;
+    }
+    sdFileCacheEvict(oldest);
+  }
+  return ESP.getFreeHeap() > size + sdFileCacheMinFreeHeap;
+}
+
+void sdFileCacheInsert(const String& path, uint32_t modified, std::vector<uint8_t>&& data, uint32_t generation) {
+  if (generation != sdFileCacheGeneration) return;  // read from a file that may have changed since
+  for (size_t i = 0; i < sdFileCache.size(); i++) {
+    if (sdFileCache[i].path.equalsIgnoreCase(path)) {
+      sdFileCacheEvict(i);
+      break;
+    }
+  }
+  if (sdFileCacheBytes + data.size() > sdFileCacheBudget) return;  // someone else took the room
+  sdFileCacheBytes += data.size();
+  sdFileCache.push_back({ path, std::move(data), modified, ++sdFileCacheTick });
+}
+
+void sdFileCacheInvalidate(const char* path) {
+  sdFileCacheGeneration++;
+  for (size_t i = 0; i < sdFileCache.size(); i++) {
+    if (sdFileCache[i].path.equalsIgnoreCase(path)) {
+      sdFileCacheEvict(i);
+      return;
+    }
+  }
+}
+
+void sdFileCacheInvalidateDir(const char* dirname) {
+  sdFileCacheGeneration++;
+  String prefix = dirname;
+  if (!prefix.endsWith("/")) prefix += "/";
+  prefix.toLowerCase();
+  for (size_t i = sdFileCache.size(); i-- > 0;) {
+    String p = sdFileCache[i].path;
+    p.toLowerCase();
+    if (p.startsWith(prefix)) sdFileCacheEvict(i);
+  }
+}
@@ -0,0 +1,248 @@
+/*
+
+- sdStat(const char* path, SDFileInfo& info) Selects path and fills info with whether it is a file or a directory, its size and its modification time (FAT date in the high 16 bits, time in the low 16, 0 if unknown). One 'I' round trip when the bridge supports it, otherwise 'F', 'E', 'S' and 'T' ('F', 'E' and 'K' for anything but a file). Returns false on an I2C error.
+- sdStatProbe() Called from setup(): turns on 'I' if the bridge answers it for the root directory.
+- SDFileReader::open(const char* path) Opens path with sdStat(). Returns false on an I2C error; a missing file opens with exists() false and size() 0.
+- SDFileReader::read(uint8_t* buf, size_t len) Reads up to len bytes from position(). Whole chunks go from the bridge straight into buf; only a tail smaller than a chunk passes through the internal buffer. Returns the number of bytes read, less than len at the end of the file or if the read failed.
+- SDFileReader::read() / peek() / available() The Stream interface, byte by byte from the internal buffer, so the reader can be handed to server.streamFile(), parsers and hashers.
+- SDFileReader::seek(uint32_t pos) Moves to pos; the next read continues there with 'O' (or 'G'). Returns false if pos is past the end.
+- SDFileReader::exists() / size() / modified() / position() / failed() Whether path is an existing file, its size and modification time as sdStat() found them, the next byte read() returns, and whether a read from the bridge has failed.
+- SDFileReader::close() Forgets the file.
+
+Reads from the bridge go through SDChunkReader, so they are CRC-checked and retried when the bridge supports 'G'.
+The bridge keeps streaming the file between two read() calls, and the reader picks up where it left off, unless
+another bus operation (SDBusOp or a queued job step, counted by sdBusOpSeq) has run in between; then it continues
+from its position with 'O' (or 'G'), after an 'F' only if sdSelectedPath shows another path was selected meanwhile. A file should only be read as far as its size: past the end the
+bridge sends 0xFF rather than stopping.
+
+*/
+
+#define SD_READER_BUFFER 64  // read-ahead for single-byte reads, at least SD_READ_CHUNK_MAX
+#define SD_STAT_FILE 0x01    // flags of an 'I' reply
+#define SD_STAT_DIR 0x02
+
+struct SDFileInfo {
+  bool isFile = false;
+  bool isDir = false;
+  uint32_t size = 0;
+  uint32_t modified = 0;
+};
+
+bool sdStatCombined = false;  // the bridge supports 'I', set by sdStatProbe()
+
+// Sends command (with an optional path) and reads len reply bytes. Returns false on an I2C error or a short reply,
+// which fails metric if one is given.
+bool sdQuery(char command, const char* path, uint8_t* reply, size_t len, SDMetric* metric = nullptr) {
+  sdWire.beginTransmission(I2C_SDCARD);
+  sdWire.write(command);
+  if (path) sdWire.write(path);
+  uint8_t error = sdWire.endTransmission(false);  // Keep connection active for requestFrom
+  size_t got = 0;
+  if (error == 0 && sdWire.requestFrom(I2C_SDCARD, (int)len, 1) == len) {
+    while (got < len && sdWire.available()) reply[got++] = sdWire.read();
+  }
+  while (sdWire.available()) sdWire.read();
+  if (got == len) return true;
+  if (metric) metric->fail(error != 0 ? error : (uint8_t)SD_ERR_SHORT_READ);
+  sdClockError();
+  return false;
+}
+
+uint32_t sdReplyU32(const uint8_t* reply) {
+  return ((uint32_t)reply[0] << 24) | ((uint32_t)reply[1] << 16) | ((uint32_t)reply[2] << 8) | reply[3];
+}
+
+bool sdStat(const char* path, SDFileInfo& info) {
+  info = SDFileInfo();
+  uint8_t reply[9];
+  SDMetric metric(SD_METRIC_STAT);
+  if (sdStatCombined) {
+    if (!sdQuery('I', path, reply, 9, &metric)) return false;
+    sdSelectedPath = path;
+    info.isFile = reply[0] & SD_STAT_FILE;
+    info.isDir = reply[0] & SD_STAT_DIR;
+    info.size = sdReplyU32(reply + 1);
+    info.modified = sdReplyU32(reply + 5);
+    return true;
+  }
+  // Bridge firmware without 'I'
+  if (!sendFilename(path)) {
+    metric.fail();
+    return false;
+  }
+  if (!sdQuery('E', nullptr, reply, 1, &metric)) return false;
+  info.isFile = reply[0] == 1;
+  if (!info.isFile) {
+    if (!sdQuery('K', nullptr, reply, 1, &metric)) return false;
+    info.isDir = reply[0] == 1;
+    return true;
+  }
+  if (!sdQuery('S', nullptr, reply, 4, &metric)) return false;
+  info.size = sdReplyU32(reply);
+  if (sdQuery('T', nullptr, reply, 4)) info.modified = sdReplyU32(reply);  // unknown without 'T' either
+  if (info.modified == 0xFFFFFFFF) info.modified = 0;  // command not understood, the bus idled high
+  return true;
+}
+
+void sdStatProbe() {
+  const uint8_t cmd[2] = { 'I', '/' };
+  uint8_t reply[9];
+  sdStatCombined = sdProbeCommand(cmd, sizeof(cmd), reply, sizeof(reply)) && reply[0] == SD_STAT_DIR;
+  sdSelectedPath = sdStatCombined ? "/" : "";
+  Serial.println(sdStatCombined ? "Combined open/stat ('I') enabled" : "Bridge does not support 'I', opening files with 'F', 'E', 'S', 'T'");
+}
+
+class SDFileReader : public Stream {
+  public:
+    bool open(const char* path) {
+      close();
+      SDBusOp busOp(SD_OP_STAT);
+      if (!sdStat(path, _info)) {
+        Serial.print("I2C Error opening ");
+        Serial.println(path);
+        return false;
+      }
+      _size = _info.size;
+      _path = path;
+      _open = true;
+      _seqAt = sdBusOpSeq;
+      return true;
+    }
+
+    void close() {
+      _open = false;
+      _info = SDFileInfo();
+      _failed = false;
+      _streaming = false;
+      _size = 0;
+      _pos = 0;
+      _streamAt = 0;
+      _bufPos = 0;
+      _bufLen = 0;
+    }
+
+    bool isOpen() const { return _open; }
+    bool failed() const { return _failed; }
+    bool exists() const { return _info.isFile; }
+    uint32_t size() const { return _size; }
+    uint32_t modified() const { return _info.modified; }
+    uint32_t position() const { return _pos; }
+    const String& path() const { return _path; }
+
+    bool seek(uint32_t pos) {
+      if (!_open || pos > _size) return false;
+      uint32_t bufferedFrom = _streamAt - _bufLen;
+      if (pos >= bufferedFrom && pos <= _streamAt) {
+        _bufPos = pos - bufferedFrom;  // still in the buffer
+      } else {
+        _bufPos = 0;
+        _bufLen = 0;
+        _streamAt = pos;
+        _streaming = false;
+      }
+      _pos = pos;
+      return true;
+    }
+
+    int available() override {
+      return _open ? (int)min(_size - _pos, (uint32_t)INT32_MAX) : 0;
+    }
+
+    int read() override {
+      if (!fillBuffer()) return -1;
+      _pos++;
+      return _buf[_bufPos++];
+    }
+
+    int peek() override {
+      if (!fillBuffer()) return -1;
+      return _buf[_bufPos];
+    }
+
+    int read(uint8_t* buf, size_t len) override {
+      if (!_open) return 0;
+      len = min(len, (size_t)(_size - _pos));
+      size_t done = min(len, _bufLen - _bufPos);
+      memcpy(buf, _buf + _bufPos, done);
+      _bufPos += done;
+      _pos += done;
+      if (done < len) {
+        _bufPos = 0;
+        _bufLen = 0;
+        // The buffer is empty now. A chunk may only be read into buf whole: in checked mode the bridge moves on by a frame
+        size_t direct = len - done;
+        if (direct < SD_READ_CHUNK_MAX && direct < _size - _pos) direct = 0;
+        size_t got = direct > 0 ? pull(buf + done, direct) : 0;
+        done += got;
+        _pos += got;
+        while (done < len && fillBuffer()) {
+          size_t n = min(len - done, _bufLen - _bufPos);
+          memcpy(buf + done, _buf + _bufPos, n);
+          _bufPos += n;
+          _pos += n;
+          done += n;
+        }
+      }
+      return (int)done;
+    }
+
+    size_t write(uint8_t) override { return 0; }  // read-only; writing is SDFileWriter's job
+
+  private:
+    String _path;
+    SDFileInfo _info;
+    SDChunkReader _reader;
+    uint8_t _buf[SD_READER_BUFFER];
+    size_t _bufPos = 0;         // next byte of _buf to hand out
+    size_t _bufLen = 0;
+    uint32_t _size = 0;
+    uint32_t _pos = 0;          // next byte read() returns
+    uint32_t _streamAt = 0;     // next byte the bridge sends
+    uint32_t _seqAt = 0;        // sdBusOpSeq after our last bus access
+    bool _open = false;
+    bool _streaming = false;    // the bridge is sending our file from _streamAt
+    bool _failed = false;
+
+    bool fillBuffer() {
+      if (_bufPos < _bufLen) return true;
+      if (!_open || _pos >= _size) return false;
+      _bufPos = 0;
+      _bufLen = pull(_buf, min((uint32_t)SD_READER_BUFFER, _size - _pos));
+      return _bufLen > 0;
+    }
+
+    // Reads len bytes at _streamAt from the bridge into dst, in whole chunks: len must be a multiple of
+    // SD_READ_CHUNK_MAX or reach the end of the file. Returns the number of bytes read.
+    size_t pull(uint8_t* dst, size_t len) {
+      if (_failed || len == 0) return 0;
+      bool current = sdBusUntouchedSince(_seqAt);  // nothing else has used the bus since our last access
+      SDBusOp busOp(SD_OP_READ);
+      if (!current) _streaming = false;
+      if (!_streaming) _streaming = sendFilename(_path.c_str()) && _reader.begin(_streamAt);
+      size_t done = 0;
+      bool ok = _streaming;
+      if (_streaming) {
+        while (done + SD_READ_CHUNK_MAX <= len || (done < len && len - done >= _size - _streamAt)) {
+          uint32_t got = _reader.read(dst + done, _size - _streamAt);
+          if (got == 0) {
+            ok = false;
+            break;
+          }
+          done += got;
+          _streamAt += got;
+          yield(); // Allow TCP stack to process
+        }
+        _reader.end();  // Send STOP; the bridge keeps its place in the file
+      }
+      if (!ok) {
+        _failed = true;
+        _streaming = false;
+        Serial.print("Error reading ");
+        Serial.print(_path);
+        Serial.print(" at offset ");
+        Serial.println(_streamAt);
+      }
+      _seqAt = sdBusOpSeq;
+      return done;
+    }
+};
@@ -0,0 +1,169 @@
+/*
+
+- SDFileWriter::open(const char* path, bool append, size_t bufferSize, uint32_t flushMs) Starts writing path: appending to it, or replacing it if append is false. Up to bufferSize bytes are collected in RAM before they go to the card; 0 writes everything straight through. Returns false if a file is already open or the path is empty.
+- SDFileWriter::write(const uint8_t* data, size_t len) Queues len bytes (any values, NUL included) and writes the buffer out whenever it fills. Being a Print, print()/println()/printf() work as well. Returns len, or 0 once a write to the card has failed.
+- SDFileWriter::flush() Writes out whatever is buffered.
+- SDFileWriter::close() Flushes and closes the file. An empty file opened with append = false is still created. Returns false if any write failed.
+- SDFileWriter::abort() Closes the file without writing what is still buffered (and without creating an empty file). What has already reached the card stays there.
+- SDFileWriter::failed() True once a write to the card has failed; later writes are dropped until the file is reopened.
+- SDFileWriter::pollAll() Called from loop(): flushes every open writer whose oldest buffered byte has waited flushMs.
+
+storetoSD() pays for an 'F' and, before ready-polling, fixed delays on every call, which adds up for a logger that
+appends one line at a time. A writer keeps its data in RAM until bufferSize bytes are queued (or flushMs has passed,
+or it is closed) and then writes them in SD_WRITE_CHUNK-byte 'W'/'A' transactions with sdWriteChunk(). The bridge
+takes a chunk only once the card has committed the one before, so each chunk is its own readiness poll, and only
+the last chunk of a flush is followed by sdWaitReady(), for whatever uses the bus next. The path goes through
+sendFilename(), so 'F' is only sent again when something else has selected another path since the writer's last
+flush.
+Each flush drops the file from the RAM caches, so readers never see a stale copy.
+
+*/
+#include <vector>
+#include <algorithm>
+
+#define SD_WRITE_CHUNK 31              // payload bytes per write transaction: the bridge's 32-byte buffer minus the command
+#define SD_WRITER_BUFFER 512           // default RAM buffer of a writer
+#define SD_WRITER_FLUSH_MS 2000        // default age at which buffered data is written out
+
+class SDFileWriter : public Print {
+  public:
+    ~SDFileWriter() { close(); }
+
+    bool open(const char* path, bool append = true, size_t bufferSize = SD_WRITER_BUFFER, uint32_t flushMs = SD_WRITER_FLUSH_MS) {
+      if (_open || !path || !*path) return false;
+      _path = path;
+      _truncate = !append;
+      _failed = false;
+      _written = 0;
+      _flushMs = flushMs;
+      _buffer.clear();
+      _buffer.reserve(bufferSize);
+      _capacity = bufferSize;
+      _open = true;
+      writers().push_back(this);
+      sdFileCacheInvalidate(path);
+      sdDirCacheInvalidate(path);
+      return true;
+    }
+
+    size_t write(const uint8_t* data, size_t len) override {
+      if (!_open || _failed) return 0;
+      if (_buffer.empty() && len >= _capacity) {
+        return writeOut(data, len) ? len : 0;  // nothing to coalesce with, skip the copy
+      }
+      size_t done = 0;
+      while (done < len) {
+        if (_buffer.empty()) _bufferedSince = millis();
+        size_t n = std::min(len - done, _capacity - _buffer.size());
+        _buffer.insert(_buffer.end(), data + done, data + done + n);
+        done += n;
+        if (_buffer.size() >= _capacity && !flushBuffer()) return 0;
+      }
+      return len;
+    }
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    using Print::write;
+
+    void flush() override { flushBuffer(); }
+
+    bool close() {
+      if (!_open) return !_failed;
+      flushBuffer();
+      if (_truncate && !_failed) {
+        // Nothing was written: a 'W' without data still creates (or empties) the file
+        SDBusOp busOp(SD_OP_WRITE);
+        SDMetric metric(SD_METRIC_WRITE);
+        _failed = !sendFilename(_path.c_str());
+        if (_failed) {
+          metric.fail();
+        } else {
+          uint8_t error = sdWriteChunk('W', nullptr, 0);
+          if (error != 0 || !sdWaitReady()) {
+            _failed = true;
+            sdI2CError(metric, error != 0 ? error : (uint8_t)SD_ERR_NOT_READY);
+          }
+        }
+        _truncate = false;
+      }
+      _open = false;
+      std::vector<SDFileWriter*>& all = writers();
+      all.erase(std::remove(all.begin(), all.end(), this), all.end());
+      std::vector<uint8_t>().swap(_buffer);
+      return !_failed;
+    }
+
+    void abort() {
+      _buffer.clear();
+      _truncate = false;
+      close();
+    }
+
+    bool isOpen() const { return _open; }
+    bool failed() const { return _failed; }
+    uint32_t bytesWritten() const { return _written; }  // bytes that have reached the card
+    const String& path() const { return _path; }
+
+    static void pollAll() {
+      uint32_t now = millis();
+      for (SDFileWriter* w : writers()) {
+        if (!w->_buffer.empty() && now - w->_bufferedSince >= w->_flushMs) {
+          SDProfileSection section("writer", "flush", w->_path.c_str());
+          w->flushBuffer();
+        }
+      }
+    }
+
+  private:
+    String _path;
+    std::vector<uint8_t> _buffer;
+    size_t _capacity = 0;
+    uint32_t _flushMs = SD_WRITER_FLUSH_MS;
+    uint32_t _bufferedSince = 0;  // millis() when the oldest buffered byte arrived
+    uint32_t _written = 0;
+    bool _open = false;
+    bool _truncate = false;       // the next chunk replaces the file ('W')
+    bool _failed = false;
+
+    static std::vector<SDFileWriter*>& writers() {
+      static std::vector<SDFileWriter*> all;
+      return all;
+    }
+
+    bool flushBuffer() {
+      if (_buffer.empty() || _failed) return !_failed;
+      bool ok = writeOut(_buffer.data(), _buffer.size());
+      _buffer.clear();
+      return ok;
+    }
+
+    bool writeOut(const uint8_t* data, size_t len) {
+      SDBusOp busOp(SD_OP_WRITE);
+      sdFileCacheInvalidate(_path.c_str());
+      sdDirCacheInvalidate(_path.c_str());
+      if (!sendFilename(_path.c_str())) {
+        _failed = true;
+        return false;
+      }
+      SDMetric metric(SD_METRIC_WRITE);
+      for (size_t pos = 0; pos < len; pos += SD_WRITE_CHUNK) {
+        size_t n = std::min(len - pos, (size_t)SD_WRITE_CHUNK);
+        uint8_t error = sdWriteChunk(_truncate ? 'W' : 'A', data + pos, n);
+        if (error != 0 || (pos + n >= len && !sdWaitReady())) {
+          Serial.print("Write to ");
+          Serial.print(_path);
+          Serial.print(" failed at byte ");
+          Serial.print(_written);
+          Serial.print(error != 0 ? ", I2C Error " : ", card did not commit in time");
+          if (error != 0) Serial.print(error);
+          Serial.println();
+          sdI2CError(metric, error != 0 ? error : (uint8_t)SD_ERR_NOT_READY);
+          _failed = true;
+          return false;
+        }
+        _truncate = false;
+        _written += n;
+        metric.bytes(n);
+      }
+      return true;
+    }
+};
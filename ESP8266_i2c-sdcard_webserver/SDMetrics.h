@@ -0,0 +1,132 @@
+/*
+
+- SDMetric A scope guard around one bridge operation of a kind (SD_METRIC_SELECT, SD_METRIC_STAT, SD_METRIC_READ, SD_METRIC_LIST, SD_METRIC_WRITE, SD_METRIC_DELETE). When it ends, the call, its duration, the bytes passed to bytes() and whether fail() was called are added to sdMetrics.
+- SDMetric::fail(uint8_t error) Marks the operation failed and counts the error: a Wire error code (1-5) or one of SD_ERR_SHORT_READ, SD_ERR_CRC, SD_ERR_NOT_READY. Without a code (the error was already counted by a nested operation, such as the select of a stat) only the failure is counted.
+- sdMetricsError(uint8_t kind, uint8_t error) Counts an error that did not fail the operation (a retried frame).
+- sdMetricsPrint(Print& out) Writes the per-kind call, failure, byte and error counters and the latency histograms in Prometheus text format.
+- sdPromHeader() / sdPromValue() Helpers for writing further Prometheus families.
+
+The kinds are finer than the SDBusOp kinds: a download is one SDBusOp but many SD_METRIC_READ chunks, and every
+'F' is an SD_METRIC_SELECT of its own, so a bus that degrades shows up as a shift in the chunk latencies and as
+addr_nack/crc counts before downloads start failing.
+
+*/
+
+enum SDMetricKind : uint8_t { SD_METRIC_SELECT, SD_METRIC_STAT, SD_METRIC_READ, SD_METRIC_LIST, SD_METRIC_WRITE, SD_METRIC_DELETE, SD_METRIC_KINDS };
+const char* const sdMetricNames[SD_METRIC_KINDS] = { "select", "stat", "read_chunk", "list", "write", "delete" };
+
+// Error codes 1-5 are Wire.endTransmission()'s, the rest are detected by the sketch
+enum SDMetricError : uint8_t { SD_ERR_SHORT_READ = 6, SD_ERR_CRC = 7, SD_ERR_NOT_READY = 8, SD_ERR_CODES = 9 };
+const char* const sdMetricErrorNames[SD_ERR_CODES] = { "none", "data_too_long", "addr_nack", "data_nack", "other",
+                                                        "timeout", "short_read", "crc", "not_ready" };
+
+// Upper bounds of the latency buckets in microseconds; the last bucket is +Inf
+const uint32_t sdMetricBucketsUs[] = { 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 100000, 500000 };
+const uint8_t sdMetricBucketCount = sizeof(sdMetricBucketsUs) / sizeof(sdMetricBucketsUs[0]);
+
+struct SDMetricStats {
+  uint32_t calls = 0;
+  uint32_t failures = 0;
+  uint32_t bytes = 0;
+  uint64_t totalUs = 0;
+  uint32_t buckets[sdMetricBucketCount + 1] = {0};  // not cumulative; sdMetricsPrint() sums them up
+  uint32_t errors[SD_ERR_CODES] = {0};
+};
+
+SDMetricStats sdMetrics[SD_METRIC_KINDS];
+uint32_t sdMetricsSelectSkipped = 0;  // sendFilename() calls answered from sdSelectedPath
+
+void sdMetricsError(uint8_t kind, uint8_t error) {
+  sdMetrics[kind].errors[error < SD_ERR_CODES ? error : 4]++;  // unknown codes count as "other"
+}
+
+class SDMetric {
+  public:
+    explicit SDMetric(uint8_t kind) : _kind(kind), _started(micros()) {}
+    ~SDMetric() {
+      SDMetricStats& s = sdMetrics[_kind];
+      uint32_t us = micros() - _started;
+      uint8_t b = 0;
+      while (b < sdMetricBucketCount && us > sdMetricBucketsUs[b]) b++;
+      s.calls++;
+      s.buckets[b]++;
+      s.totalUs += us;
+      s.bytes += _bytes;
+      if (_failed) s.failures++;
+    }
+
+    void bytes(uint32_t n) { _bytes += n; }
+    void fail(uint8_t error = 0) {
+      _failed = true;
+      if (error != 0) sdMetricsError(_kind, error);
+    }
+
+  private:
+    uint8_t _kind;
+    uint32_t _started;
+    uint32_t _bytes = 0;
+    bool _failed = false;
+};
+
+void sdPromHeader(Print& out, const char* name, const char* type, const char* help) {
+  out.print(F("# HELP "));
+  out.print(name);
+  out.print(' ');
+  out.println(help);
+  out.print(F("# TYPE "));
+  out.print(name);
+  out.print(' ');
+  out.println(type);
+}
+
+// name{label="value"} number; label may be null
+void sdPromValue(Print& out, const char* name, const char* label, const char* labelValue, double value) {
+  out.print(name);
+  if (label) {
+    out.print('{');
+    out.print(label);
+    out.print(F("=\""));
+    out.print(labelValue);
+    out.print(F("\"}"));
+  }
+  out.print(' ');
+  if (value == (double)(uint32_t)value) out.println((uint32_t)value);
+  else out.println(value, 6);
+}
+
+void sdMetricsPrint(Print& out) {
+  sdPromHeader(out, "sd_op_duration_seconds", "histogram", "Duration of bridge operations");
+  for (uint8_t k = 0; k < SD_METRIC_KINDS; k++) {
+    const SDMetricStats& s = sdMetrics[k];
+    uint32_t cumulative = 0;
+    for (uint8_t b = 0; b <= sdMetricBucketCount; b++) {
+      cumulative += s.buckets[b];
+      out.print(F("sd_op_duration_seconds_bucket{op=\""));
+      out.print(sdMetricNames[k]);
+      out.print(F("\",le=\""));
+      if (b < sdMetricBucketCount) out.print(sdMetricBucketsUs[b] / 1e6, 6);
+      else out.print(F("+Inf"));
+      out.print(F("\"} "));
+      out.println(cumulative);
+    }
+    sdPromValue(out, "sd_op_duration_seconds_sum", "op", sdMetricNames[k], s.totalUs / 1e6);
+    sdPromValue(out, "sd_op_duration_seconds_count", "op", sdMetricNames[k], s.calls);
+  }
+  sdPromHeader(out, "sd_op_failures_total", "counter", "Bridge operations that failed");
+  for (uint8_t k = 0; k < SD_METRIC_KINDS; k++) sdPromValue(out, "sd_op_failures_total", "op", sdMetricNames[k], sdMetrics[k].failures);
+  sdPromHeader(out, "sd_op_bytes_total", "counter", "Payload bytes moved by bridge operations");
+  for (uint8_t k = 0; k < SD_METRIC_KINDS; k++) sdPromValue(out, "sd_op_bytes_total", "op", sdMetricNames[k], sdMetrics[k].bytes);
+  sdPromHeader(out, "sd_i2c_errors_total", "counter", "I2C errors by operation and cause, including retried ones");
+  for (uint8_t k = 0; k < SD_METRIC_KINDS; k++) {
+    for (uint8_t e = 1; e < SD_ERR_CODES; e++) {
+      out.print(F("sd_i2c_errors_total{op=\""));
+      out.print(sdMetricNames[k]);
+      out.print(F("\",error=\""));
+      out.print(sdMetricErrorNames[e]);
+      out.print(F("\"} "));
+      out.println(sdMetrics[k].errors[e]);
+    }
+  }
+  sdPromHeader(out, "sd_select_skipped_total", "counter", "Path selections skipped because the bridge already had the path");
+  sdPromValue(out, "sd_select_skipped_total", nullptr, nullptr, sdMetricsSelectSkipped);
+}
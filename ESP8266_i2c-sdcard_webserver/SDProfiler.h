@@ -0,0 +1,230 @@
+/*
+
+- SDProfileLoop A scope guard for one loop() iteration. Its duration goes into the loop histogram, and an iteration of at least sdProfileStallUs is a stall: it is counted and, if it is among the SD_PROFILE_STALLS longest so far, kept in the stall table together with the section that took the most time in it.
+- SDProfileSection(const char* kind, const char* name, const char* path) A scope guard for one piece of work inside loop(): a route handler ("route", its URI pattern, the requested path), a bus job step ("job", its SDBusOp kind, the file) or a writer flush ("writer", "flush", the file). Its count, total and longest time are added to the (kind, name) entry. A section that runs outside loop() (the host simulator dispatches requests itself) counts as an iteration of its own.
+- sdProfiled(const char* route, std::function<void()> handler) Wraps a route handler for server.on() / onNotFound() in an SDProfileSection, with server.uri() as the path.
+- SDProfileSpin A scope guard around a busy-wait (CustDelay(), sdWaitReady()); its time is added to sdProfileSpinUs.
+- sdProfilePrint(Print& out) Writes the loop histogram, the per-section times and the stall table as plain text.
+- sdProfileReset() Clears all of it, e.g. before measuring a fix.
+
+The sketch is single threaded, so while a handler or a job step runs nobody else is served: a stall is the time
+another client's request would have waited. Sections cost two micros() calls and no allocation; a path is only copied
+(truncated to SD_PROFILE_PATH - 1 characters) when its section becomes the longest of the iteration.
+
+*/
+#include <functional>
+
+#define SD_PROFILE_STALLS 8    // longest stalls kept
+#define SD_PROFILE_SECTIONS 16 // distinct (kind, name) pairs tracked; further ones are not counted
+#define SD_PROFILE_PATH 48     // bytes kept of a stall's path
+
+uint32_t sdProfileStallUs = 50000;  // loop iterations at least this long count as stalls
+
+// Upper bounds of the loop histogram buckets in microseconds; the last bucket is +Inf
+const uint32_t sdProfileBucketsUs[] = { 1000, 5000, 10000, 50000, 100000, 500000, 1000000 };
+const uint8_t sdProfileBucketCount = sizeof(sdProfileBucketsUs) / sizeof(sdProfileBucketsUs[0]);
+
+struct SDProfileSectionStats {
+  const char* kind;
+  const char* name;
+  uint32_t count;
+  uint32_t maxUs;
+  uint64_t totalUs;
+};
+
+struct SDProfileStall {
+  uint32_t us;
+  uint32_t at;          // millis() when the iteration ended
+  const char* kind;     // longest section of the iteration, "loop" if none ran
+  const char* name;
+  char path[SD_PROFILE_PATH];
+};
+
+struct SDProfileStats {
+  uint32_t iterations = 0;
+  uint64_t totalUs = 0;
+  uint32_t maxUs = 0;
+  uint32_t buckets[sdProfileBucketCount + 1] = {0};
+  uint32_t stalls = 0;
+  uint32_t since = 0;   // millis() of the last reset
+};
+
+SDProfileStats sdProfileStats;
+SDProfileSectionStats sdProfileSections[SD_PROFILE_SECTIONS];
+uint8_t sdProfileSectionCount = 0;
+SDProfileStall sdProfileStalls[SD_PROFILE_STALLS];  // longest first, us == 0 marks an empty slot
+uint64_t sdProfileSpinUs = 0;
+
+// Longest section of the running loop() iteration
+SDProfileStall sdProfileSuspect;
+bool sdProfileInLoop = false;
+uint8_t sdProfileDepth = 0;  // nesting of running sections
+
+void sdProfileReset() {
+  sdProfileStats = SDProfileStats();
+  sdProfileStats.since = millis();
+  sdProfileSectionCount = 0;
+  for (uint8_t i = 0; i < SD_PROFILE_STALLS; i++) sdProfileStalls[i].us = 0;
+  sdProfileSpinUs = 0;
+}
+
+void sdProfileSetPath(char* dst, const char* path) {
+  strncpy(dst, path ? path : "", SD_PROFILE_PATH - 1);
+  dst[SD_PROFILE_PATH - 1] = 0;
+}
+
+// Adds a loop() iteration of us microseconds, blamed on sdProfileSuspect if it is a stall
+void sdProfileIteration(uint32_t us) {
+  SDProfileStats& s = sdProfileStats;
+  uint8_t b = 0;
+  while (b < sdProfileBucketCount && us > sdProfileBucketsUs[b]) b++;
+  s.iterations++;
+  s.buckets[b]++;
+  s.totalUs += us;
+  if (us > s.maxUs) s.maxUs = us;
+  if (us < sdProfileStallUs) return;
+  s.stalls++;
+  uint8_t slot = SD_PROFILE_STALLS;
+  while (slot > 0 && sdProfileStalls[slot - 1].us < us) slot--;
+  if (slot == SD_PROFILE_STALLS) return;  // shorter than every stall kept
+  for (uint8_t i = SD_PROFILE_STALLS - 1; i > slot; i--) sdProfileStalls[i] = sdProfileStalls[i - 1];
+  SDProfileStall& stall = sdProfileStalls[slot];
+  stall = sdProfileSuspect;
+  stall.us = us;
+  stall.at = millis();
+  if (sdProfileSuspect.us == 0) {
+    stall.kind = "loop";
+    stall.name = "-";
+    stall.path[0] = 0;
+  }
+}
+
+class SDProfileSection {
+  public:
+    SDProfileSection(const char* kind, const char* name, const char* path)
+      : _kind(kind), _name(name), _path(path), _started(micros()) {
+      sdProfileDepth++;
+    }
+    ~SDProfileSection() {
+      uint32_t us = micros() - _started;
+      sdProfileDepth--;
+      SDProfileSectionStats* s = find();
+      if (s) {
+        s->count++;
+        s->totalUs += us;
+        if (us > s->maxUs) s->maxUs = us;
+      }
+      if (us > sdProfileSuspect.us) {
+        sdProfileSuspect.us = us;
+        sdProfileSuspect.kind = _kind;
+        sdProfileSuspect.name = _name;
+        sdProfileSetPath(sdProfileSuspect.path, _path);
+      }
+      if (!sdProfileInLoop && sdProfileDepth == 0) {
+        sdProfileIteration(us);
+        sdProfileSuspect.us = 0;
+      }
+    }
+
+  private:
+    const char* _kind;
+    const char* _name;
+    const char* _path;
+    uint32_t _started;
+
+    SDProfileSectionStats* find() {
+      for (uint8_t i = 0; i < sdProfileSectionCount; i++) {
+        SDProfileSectionStats& s = sdProfileSections[i];
+        if ((s.kind == _kind || strcmp(s.kind, _kind) == 0) && (s.name == _name || strcmp(s.name, _name) == 0)) return &s;
+      }
+      if (sdProfileSectionCount == SD_PROFILE_SECTIONS) return nullptr;
+      sdProfileSections[sdProfileSectionCount] = { _kind, _name, 0, 0, 0 };
+      return &sdProfileSections[sdProfileSectionCount++];
+    }
+};
+
+class SDProfileLoop {
+  public:
+    SDProfileLoop() : _started(micros()) {
+      sdProfileSuspect.us = 0;
+      sdProfileInLoop = true;
+    }
+    ~SDProfileLoop() {
+      sdProfileInLoop = false;
+      sdProfileIteration(micros() - _started);
+    }
+
+  private:
+    uint32_t _started;
+};
+
+class SDProfileSpin {
+  public:
+    SDProfileSpin() : _started(micros()) {}
+    ~SDProfileSpin() { sdProfileSpinUs += micros() - _started; }
+
+  private:
+    uint32_t _started;
+};
+
+std::function<void()> sdProfiled(const char* route, std::function<void()> handler) {
+  return [route, handler]() {
+    const String& uri = server.uri();
+    SDProfileSection section("route", route, uri.c_str());
+    handler();
+  };
+}
+
+void sdProfilePrint(Print& out) {
+  const SDProfileStats& s = sdProfileStats;
+  out.print(F("since_ms "));
+  out.println(millis() - s.since);
+  out.print(F("loop iterations "));
+  out.print(s.iterations);
+  out.print(F(" avg_us "));
+  out.print(s.iterations ? (uint32_t)(s.totalUs / s.iterations) : 0);
+  out.print(F(" max_ms "));
+  out.print(s.maxUs / 1000.0, 1);
+  out.print(F(" stalls "));
+  out.print(s.stalls);
+  out.print(F(" stall_ms "));
+  out.println(sdProfileStallUs / 1000.0, 1);
+  out.print(F("loop_ms"));
+  for (uint8_t b = 0; b <= sdProfileBucketCount; b++) {
+    out.print(F(" le_"));
+    if (b < sdProfileBucketCount) out.print(sdProfileBucketsUs[b] / 1000);
+    else out.print(F("inf"));
+    out.print(' ');
+    out.print(s.buckets[b]);
+  }
+  out.println();
+  out.print(F("spin_ms "));
+  out.println((uint32_t)(sdProfileSpinUs / 1000));
+  for (uint8_t i = 0; i < sdProfileSectionCount; i++) {
+    const SDProfileSectionStats& sec = sdProfileSections[i];
+    out.print(sec.kind);
+    out.print(' ');
+    out.print(sec.name);
+    out.print(F(" count "));
+    out.print(sec.count);
+    out.print(F(" total_ms "));
+    out.print((uint32_t)(sec.totalUs / 1000));
+    out.print(F(" avg_ms "));
+    out.print(sec.count ? sec.totalUs / 1000.0 / sec.count : 0.0, 1);
+    out.print(F(" max_ms "));
+    out.println(sec.maxUs / 1000.0, 1);
+  }
+  for (uint8_t i = 0; i < SD_PROFILE_STALLS && sdProfileStalls[i].us > 0; i++) {
+    const SDProfileStall& stall = sdProfileStalls[i];
+    out.print(F("stall "));
+    out.print(stall.us / 1000.0, 1);
+    out.print(F(" ms ago_s "));
+    out.print((millis() - stall.at) / 1000);
+    out.print(' ');
+    out.print(stall.kind);
+    out.print(' ');
+    out.print(stall.name);
+    out.print(' ');
+    out.println(stall.path[0] ? stall.path : "-");
+  }
+}
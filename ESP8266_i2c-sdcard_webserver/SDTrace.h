@@ -0,0 +1,205 @@
+/*
+
+- sdWire The sketch's handle on the I2C bus: forwards everything to Wire and, while tracing is on, records every transaction that ends in endTransmission() or requestFrom() in a ring buffer.
+- sdTraceBegin(uint16_t records) Starts tracing into a new ring of records entries (20 bytes each in RAM, at most SD_TRACE_MAX_RECORDS and half the largest free heap block), dropping any previous trace. 0 stops tracing and frees the ring.
+- sdTraceMarkError() Flags the newest record: called by sdClockError(), so the trace shows where the sketch saw a NACK, short read or CRC failure even when the transaction itself went through.
+- sdTracePrint(Print& out) Writes the ring, oldest first, as text: one line per transaction.
+- sdTraceWrite(Print& out) Writes the ring in the binary format below, for host_sim/trace_replay.
+
+A record holds the start time (micros()), duration, clock, address, the command byte (for a read, the command it
+answers), the bytes written (command included) or requested, the result (endTransmission()'s code, or the number
+of bytes received), up to four bytes of payload (the offset of an 'O'/'G', the first bytes of a reply) and flags.
+Recording is a few stores per transaction and nothing at all while tracing is off, so a ring of a few hundred
+entries can stay on in the field: after a failed download, /trace shows the transactions that led up to it.
+
+Binary format, little endian: "SDTR", version (1 byte), record size (1 byte, 17), record count (2 bytes),
+transactions recorded since sdTraceBegin() (4 bytes), micros() at the dump (4 bytes), then the records oldest first:
+us (4), duration_us (2), clock_khz (2), address, flags, command, length, result, data[4].
+
+*/
+#include <vector>
+
+#define SD_TRACE_READ 0x01   // requestFrom(); otherwise an endTransmission()
+#define SD_TRACE_STOP 0x02   // ended with STOP
+#define SD_TRACE_ERROR 0x04  // sdClockError() was called after this transaction
+#define SD_TRACE_RECORD_BYTES 17
+#define SD_TRACE_VERSION 1
+#define SD_TRACE_MAX_RECORDS 1000  // 20 KB of RAM
+
+struct SDTraceRecord {
+  uint32_t us;
+  uint16_t durationUs;  // saturates at 65535
+  uint16_t clockKHz;
+  uint8_t address;
+  uint8_t flags;
+  uint8_t command;
+  uint8_t length;
+  uint8_t result;
+  uint8_t data[4];
+};
+
+std::vector<SDTraceRecord> sdTraceRing;
+uint16_t sdTraceHead = 0;    // next slot to write
+uint32_t sdTraceTotal = 0;   // transactions recorded since sdTraceBegin()
+
+void sdTraceBegin(uint16_t records) {
+  std::vector<SDTraceRecord>().swap(sdTraceRing);
+  uint32_t fits = ESP.getMaxFreeBlockSize() / 2 / sizeof(SDTraceRecord);  // leave the heap to the web server
+  if (records > SD_TRACE_MAX_RECORDS) records = SD_TRACE_MAX_RECORDS;
+  if (records > fits) records = fits;
+  std::vector<SDTraceRecord>(records).swap(sdTraceRing);
+  sdTraceHead = 0;
+  sdTraceTotal = 0;
+}
+
+void sdTraceMarkError() {
+  if (sdTraceTotal == 0) return;
+  sdTraceRing[(sdTraceHead + sdTraceRing.size() - 1) % sdTraceRing.size()].flags |= SD_TRACE_ERROR;
+}
+
+class SDTraceWire : public Stream {
+  public:
+    void begin() { Wire.begin(); }
+    void setClock(uint32_t hz) {
+      _clock = hz;
+      Wire.setClock(hz);
+    }
+
+    void beginTransmission(int address) {
+      _address = address;
+      _written = 0;
+      Wire.beginTransmission(address);
+    }
+
+    size_t write(uint8_t b) override {
+      if (!sdTraceRing.empty()) note(&b, 1);
+      return Wire.write(b);
+    }
+    size_t write(const uint8_t* data, size_t len) override {
+      if (!sdTraceRing.empty()) note(data, len);
+      return Wire.write(data, len);
+    }
+    using Print::write;
+
+    uint8_t endTransmission(uint8_t sendStop = true) {
+      size_t written = _written;
+      _written = 0;  // a bare endTransmission() (the STOP after a read) sends nothing
+      if (sdTraceRing.empty()) return Wire.endTransmission(sendStop);
+      uint32_t started = micros();
+      uint8_t result = Wire.endTransmission(sendStop);
+      // An empty transmission is an address probe (sdWaitReady()) or a STOP, not a command
+      SDTraceRecord& r = record(started, _address, sendStop ? SD_TRACE_STOP : 0, written ? _command : 0, written, result);
+      if (written) memcpy(r.data, _data, 4);
+      else memset(r.data, 0, 4);
+      return result;
+    }
+
+    uint8_t requestFrom(int address, int quantity, int sendStop = true) {
+      if (sdTraceRing.empty()) return Wire.requestFrom(address, quantity, sendStop);
+      uint32_t started = micros();
+      uint8_t got = Wire.requestFrom(address, quantity, sendStop);
+      SDTraceRecord& r = record(started, address, SD_TRACE_READ | (sendStop ? SD_TRACE_STOP : 0), _command, quantity, got);
+      memset(r.data, 0, 4);
+      _replyOf = sdTraceTotal;  // read() fills in the first bytes as the sketch takes them
+      _replyPos = 0;
+      return got;
+    }
+
+    int available() override { return Wire.available(); }
+    int read() override {
+      int b = Wire.read();
+      if (_replyPos < 4 && b >= 0 && _replyOf == sdTraceTotal && !sdTraceRing.empty()) {
+        sdTraceRing[(sdTraceHead + sdTraceRing.size() - 1) % sdTraceRing.size()].data[_replyPos++] = b;
+      }
+      return b;
+    }
+    int peek() override { return Wire.peek(); }
+    void flush() override { Wire.flush(); }
+
+  private:
+    uint32_t _clock = 100000;  // the core's default
+    uint8_t _address = 0;
+    uint8_t _command = 0;      // first byte of the last transmission
+    uint8_t _data[4] = {0};    // the bytes after it
+    size_t _written = 0;
+    uint32_t _replyOf = 0;     // sdTraceTotal of the read whose reply read() is recording
+    uint8_t _replyPos = 4;
+
+    // Keeps the command byte and the four bytes after it; of the rest only the count
+    void note(const uint8_t* data, size_t len) {
+      for (size_t i = 0; i < len && _written + i < 5; i++) {
+        if (_written + i == 0) {
+          _command = data[i];
+          memset(_data, 0, 4);
+        } else {
+          _data[_written + i - 1] = data[i];
+        }
+      }
+      _written += len;
+    }
+
+    SDTraceRecord& record(uint32_t started, uint8_t address, uint8_t flags, uint8_t command, size_t length, uint8_t result) {
+      SDTraceRecord& r = sdTraceRing[sdTraceHead];
+      sdTraceHead = (sdTraceHead + 1) % sdTraceRing.size();
+      sdTraceTotal++;
+      uint32_t us = micros() - started;
+      r.us = started;
+      r.durationUs = us > 0xFFFF ? 0xFFFF : us;
+      r.clockKHz = _clock / 1000;
+      r.address = address;
+      r.flags = flags;
+      r.command = command;
+      r.length = length > 0xFF ? 0xFF : length;
+      r.result = result;
+      return r;
+    }
+};
+
+SDTraceWire sdWire;
+
+// Calls f for each record, oldest first
+template <typename F>
+void sdTraceEach(F f) {
+  uint16_t n = sdTraceTotal < sdTraceRing.size() ? sdTraceTotal : sdTraceRing.size();
+  for (uint16_t i = 0; i < n; i++) f(sdTraceRing[(sdTraceHead + sdTraceRing.size() - n + i) % sdTraceRing.size()]);
+}
+
+void sdTracePrint(Print& out) {
+  out.print(F("# tracing "));
+  out.print(sdTraceRing.empty() ? F("off") : F("on"));
+  out.print(F(", "));
+  out.print(sdTraceRing.size());
+  out.print(F(" records, "));
+  out.print(sdTraceTotal);
+  out.print(F(" transactions since start, now_us "));
+  out.println((uint32_t)micros());
+  out.println(F("# us duration_us clock_khz dir addr command length result data flags"));
+  sdTraceEach([&out](const SDTraceRecord& r) {
+    char line[72];
+    char command[5];
+    if (r.command >= 0x20 && r.command < 0x7F) snprintf(command, sizeof(command), "%c", r.command);
+    else snprintf(command, sizeof(command), "0x%02x", r.command);
+    snprintf(line, sizeof(line), "%lu %u %u %c 0x%02x %s %u %u %02x%02x%02x%02x %s%s",
+             (unsigned long)r.us, r.durationUs, r.clockKHz, r.flags & SD_TRACE_READ ? 'R' : 'W', r.address,
+             command, r.length, r.result, r.data[0], r.data[1], r.data[2], r.data[3],
+             r.flags & SD_TRACE_STOP ? "S" : "-", r.flags & SD_TRACE_ERROR ? "E" : "");
+    out.println(line);
+  });
+}
+
+void sdTraceWrite(Print& out) {
+  uint16_t n = sdTraceTotal < sdTraceRing.size() ? sdTraceTotal : sdTraceRing.size();
+  uint32_t now = micros();
+  uint8_t header[16] = { 'S', 'D', 'T', 'R', SD_TRACE_VERSION, SD_TRACE_RECORD_BYTES, (uint8_t)n, (uint8_t)(n >> 8),
+                         (uint8_t)sdTraceTotal, (uint8_t)(sdTraceTotal >> 8), (uint8_t)(sdTraceTotal >> 16), (uint8_t)(sdTraceTotal >> 24),
+                         (uint8_t)now, (uint8_t)(now >> 8), (uint8_t)(now >> 16), (uint8_t)(now >> 24) };
+  out.write(header, sizeof(header));
+  sdTraceEach([&out](const SDTraceRecord& r) {
+    uint8_t b[SD_TRACE_RECORD_BYTES] = { (uint8_t)r.us, (uint8_t)(r.us >> 8), (uint8_t)(r.us >> 16), (uint8_t)(r.us >> 24),
+                                         (uint8_t)r.durationUs, (uint8_t)(r.durationUs >> 8),
+                                         (uint8_t)r.clockKHz, (uint8_t)(r.clockKHz >> 8),
+                                         r.address, r.flags, r.command, r.length, r.result,
+                                         r.data[0], r.data[1], r.data[2], r.data[3] };
+    out.write(b, sizeof(b));
+  });
+}
@@ -0,0 +1,179 @@
+/*
+
+Host-side stand-in for the parts of the ESP8266 Arduino core the sketch uses.
+
+- Time is virtual: sim::nowUs only moves when the sketch waits (delay(), yield(), CustDelay())
+  or when a simulated peripheral (I2C bus, TCP socket) charges time for work it did. Runs are
+  therefore deterministic and independent of how fast the workstation is.
+- millis()/micros()/delay()/delayMicroseconds()/yield() operate on that virtual clock.
+- Print/Stream mirror the core's interfaces so sketch classes can derive from them.
+- Serial echoes to stdout only while sim::serialEcho is true (benchmarks switch it off).
+- ESP.getFreeHeap()/getMaxFreeBlockSize() report a nominal ESP8266 heap minus whatever the
+  sketch currently has allocated (see SimHeap.h).
+
+*/
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdarg>
+#include <cmath>
+#include <algorithm>
+#include "WString.h"
+
+using std::min;
+using std::max;
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define PGM_P const char*
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+#define LOW 0
+#define HIGH 1
+
+namespace sim {
+  inline uint64_t nowUs = 0;          // virtual time since "power on"
+  inline uint32_t yieldCostUs = 5;    // time charged for one trip through yield()
+  inline bool serialEcho = true;      // print Serial output to stdout
+  inline size_t heapInUse = 0;        // bytes currently allocated by the host program
+  inline size_t heapPeak = 0;         // high-water mark of heapInUse
+  inline int untrackedDepth = 0;      // > 0 while simulator bookkeeping allocates
+  constexpr size_t kHeapSize = 52 * 1024;  // typical free heap of an ESP8266 sketch with WiFi up
+
+  inline void advanceUs(uint64_t us) { nowUs += us; }
+  inline void resetHeapPeak() { heapPeak = heapInUse; }
+
+  // Allocations made while one of these is alive belong to the simulator (captured responses,
+  // directory snapshots) and are left out of the sketch's heap figures.
+  struct Untracked {
+    Untracked() { untrackedDepth++; }
+    ~Untracked() { untrackedDepth--; }
+  };
+}
+
+inline unsigned long millis() { return (unsigned long)(sim::nowUs / 1000); }
+inline unsigned long micros() { return (unsigned long)sim::nowUs; }
+inline void yield() { sim::advanceUs(sim::yieldCostUs); }
+inline void delay(unsigned long ms) { sim::advanceUs((uint64_t)ms * 1000); }
+inline void delayMicroseconds(unsigned int us) { sim::advanceUs(us); }
+
+class Print;
+
+class Printable {
+  public:
+    virtual ~Printable() {}
+    virtual size_t printTo(Print& p) const = 0;
+};
+
+class Print {
+  public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size) {
+      size_t n = 0;
+      while (size--) n += write(*buffer++);
+      return n;
+    }
+    size_t write(const char* str) { return str ? write((const uint8_t*)str, strlen(str)) : 0; }
+    size_t write(const char* buffer, size_t size) { return write((const uint8_t*)buffer, size); }
+    virtual int availableForWrite() { return 0; }
+    virtual void flush() {}
+
+    size_t print(const __FlashStringHelper* s) { return write(reinterpret_cast<const char*>(s)); }
+    size_t print(const String& s) { return write(s.c_str(), s.length()); }
+    size_t print(const char* s) { return write(s); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(unsigned char n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t print(int n, int base = DEC) { return print((long)n, base); }
+    size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t print(long n, int base = DEC) { return print(String(n, (unsigned char)base)); }
+    size_t print(unsigned long n, int base = DEC) { return print(String(n, (unsigned char)base)); }
+    size_t print(long long n, int base = DEC) { return print(String(n, (unsigned char)base)); }
+    size_t print(unsigned long long n, int base = DEC) { return print(String(n, (unsigned char)base)); }
+    size_t print(double n, int digits = 2) { return print(String(n, (unsigned char)digits)); }
+    size_t print(const Printable& x) { return x.printTo(*this); }
+
+    size_t println() { return write("\r\n"); }
+    template <typename T>
+    size_t println(const T& value) { size_t n = print(value); return n + println(); }
+    template <typename T>
+    size_t println(const T& value, int format) { size_t n = print(value, format); return n + println(); }
+
+    size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+      char buf[256];
+      va_list args;
+      va_start(args, format);
+      int len = vsnprintf(buf, sizeof(buf), format, args);
+      va_end(args);
+      if (len < 0) return 0;
+      return write(buf, std::min((size_t)len, sizeof(buf) - 1));
+    }
+};
+
+class Stream : public Print {
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual int read(uint8_t* buffer, size_t len) {
+      size_t n = 0;
+      int c;
+      while (n < len && (c = read()) >= 0) buffer[n++] = (uint8_t)c;
+      return (int)n;
+    }
+    void setTimeout(unsigned long timeout) { _timeout = timeout; }
+    unsigned long getTimeout() const { return _timeout; }
+    virtual size_t readBytes(char* buffer, size_t length) { return (size_t)read((uint8_t*)buffer, length); }
+    size_t readBytes(uint8_t* buffer, size_t length) { return readBytes((char*)buffer, length); }
+    String readString() {
+      String ret;
+      int c;
+      while ((c = read()) >= 0) ret += (char)c;
+      return ret;
+    }
+
+  protected:
+    unsigned long _timeout = 1000;
+};
+
+class HardwareSerial : public Stream {
+  public:
+    void begin(unsigned long) {}
+    size_t write(uint8_t c) override {
+      if (sim::serialEcho) fputc(c, stdout);
+      return 1;
+    }
+    size_t write(const uint8_t* buffer, size_t size) override {
+      if (sim::serialEcho) fwrite(buffer, 1, size, stdout);
+      return size;
+    }
+    using Print::write;
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+    operator bool() const { return true; }
+};
+
+inline HardwareSerial Serial;
+
+class EspClass {
+  public:
+    uint32_t getFreeHeap() { return sim::heapInUse < sim::kHeapSize ? (uint32_t)(sim::kHeapSize - sim::heapInUse) : 0; }
+    uint32_t getMaxFreeBlockSize() { return getFreeHeap(); }
+    uint8_t getHeapFragmentation() { return 0; }
+    uint32_t getChipId() { return 0x00E5B1u; }
+    uint32_t getCycleCount() { return (uint32_t)(sim::nowUs * 80); }  // 80 MHz core clock
+    uint8_t getCpuFreqMHz() { return 80; }
+    void restart() { exit(0); }
+};
+
+inline EspClass ESP;
@@ -0,0 +1,384 @@
+/*
+
+Host-side stand-in for ESP8266WebServer.
+
+Route registration, argument/header access and the send()/sendContent()/streamFile() family follow
+the core (including chunked transfer when the content length is CONTENT_LENGTH_UNKNOWN, only
+keeping headers named in collectHeaders(), and calling upload handlers with
+UPLOAD_FILE_START/WRITE/END before the route handler). Instead of accepting sockets,
+simRequest() dispatches a request to the registered handlers and returns the SimConnection that
+received the response. After the handler returns the server drops its reference; if nothing else
+(such as a transfer kept alive by loop()) holds a copy of the client, the connection is closed.
+
+simParseResponse() splits what was written into status, headers and (de-chunked) body.
+
+*/
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <vector>
+#include <utility>
+#include "Arduino.h"
+#include "ESP8266WiFi.h"
+
+enum HTTPMethod { HTTP_ANY, HTTP_GET, HTTP_HEAD, HTTP_POST, HTTP_PUT, HTTP_PATCH, HTTP_DELETE, HTTP_OPTIONS };
+enum HTTPUploadStatus { UPLOAD_FILE_START, UPLOAD_FILE_WRITE, UPLOAD_FILE_END, UPLOAD_FILE_ABORTED };
+
+#define CONTENT_LENGTH_UNKNOWN ((size_t) -1)
+#define CONTENT_LENGTH_NOT_SET ((size_t) -2)
+
+#ifndef HTTP_UPLOAD_BUFLEN
+#define HTTP_UPLOAD_BUFLEN 2048
+#endif
+
+struct HTTPUpload {
+  HTTPUploadStatus status;
+  String filename;
+  String name;
+  String type;
+  size_t totalSize;
+  size_t currentSize;
+  size_t contentLength;
+  uint8_t buf[HTTP_UPLOAD_BUFLEN];
+};
+
+struct SimHttpRequest {
+  HTTPMethod method = HTTP_GET;
+  String uri;                                         // may carry a ?query string
+  std::vector<std::pair<String, String>> headers;
+  std::vector<uint8_t> body;                          // application/x-www-form-urlencoded args, or the uploaded file
+  String uploadFilename;                              // non-empty: deliver body to the upload handler as this file
+};
+
+struct SimHttpResponse {
+  int status = 0;
+  std::vector<std::pair<String, String>> headers;
+  std::vector<uint8_t> body;
+  bool chunked = false;
+
+  String header(const String& name) const {
+    for (const auto& h : headers) if (h.first.equalsIgnoreCase(name)) return h.second;
+    return String();
+  }
+};
+
+class ESP8266WebServer {
+  public:
+    typedef std::function<void(void)> THandlerFunction;
+
+    explicit ESP8266WebServer(int port = 80) : _port(port) {}
+
+    void begin() {}
+    void begin(uint16_t) {}
+    void close() {}
+    void stop() {}
+    void handleClient() {}  // requests are injected with simRequest()
+
+    void on(const String& uri, THandlerFunction handler) { on(uri, HTTP_ANY, handler); }
+    void on(const String& uri, HTTPMethod method, THandlerFunction fn) { on(uri, method, fn, nullptr); }
+    void on(const String& uri, HTTPMethod method, THandlerFunction fn, THandlerFunction ufn) {
+      _routes.push_back({uri, method, fn, ufn});
+    }
+    void onNotFound(THandlerFunction fn) { _notFound = fn; }
+    void onFileUpload(THandlerFunction ufn) { _fileUpload = ufn; }
+
+    String uri() const { return _uri; }
+    HTTPMethod method() const { return _method; }
+    WiFiClient& client() { return _currentClient; }
+    HTTPUpload& upload() { return *_upload; }
+
+    String arg(const String& name) const {
+      for (const auto& a : _args) if (a.first == name) return a.second;
+      return String();
+    }
+    String arg(int i) const { return i >= 0 && i < (int)_args.size() ? _args[i].second : String(); }
+    String argName(int i) const { return i >= 0 && i < (int)_args.size() ? _args[i].first : String(); }
+    int args() const { return (int)_args.size(); }
+    bool hasArg(const String& name) const {
+      for (const auto& a : _args) if (a.first == name) return true;
+      return false;
+    }
+
+    void collectHeaders(const char* headerKeys[], const size_t headerKeysCount) {
+      _collect.clear();
+      for (size_t i = 0; i < headerKeysCount; i++) _collect.push_back(headerKeys[i]);
+    }
+    String header(const String& name) const {
+      for (const auto& h : _headers) if (h.first.equalsIgnoreCase(name)) return h.second;
+      return String();
+    }
+    String header(int i) const { return i >= 0 && i < (int)_headers.size() ? _headers[i].second : String(); }
+    String headerName(int i) const { return i >= 0 && i < (int)_headers.size() ? _headers[i].first : String(); }
+    int headers() const { return (int)_headers.size(); }
+    bool hasHeader(const String& name) const {
+      for (const auto& h : _headers) if (h.first.equalsIgnoreCase(name)) return true;
+      return false;
+    }
+    String hostHeader() const { return header("Host"); }
+
+    void setContentLength(const size_t contentLength) { _contentLength = contentLength; }
+    void sendHeader(const String& name, const String& value, bool first = false) {
+      String line = name + ": " + value + "\r\n";
+      if (first) _responseHeaders = line + _responseHeaders;
+      else _responseHeaders += line;
+    }
+
+    void send(int code, const char* content_type = NULL, const String& content = emptyString) {
+      sendBody(code, content_type, (const uint8_t*)content.c_str(), content.length());
+    }
+    void send(int code, char* content_type, const String& content) { send(code, (const char*)content_type, content); }
+    void send(int code, const String& content_type, const String& content) { send(code, content_type.c_str(), content); }
+    void send(int code, const char* content_type, const char* content) { send(code, content_type, content, strlen(content)); }
+    void send(int code, const char* content_type, const char* content, size_t contentLength) {
+      sendBody(code, content_type, (const uint8_t*)content, contentLength);
+    }
+    void send(int code, const char* content_type, const uint8_t* content, size_t contentLength) {
+      sendBody(code, content_type, content, contentLength);
+    }
+    void send_P(int code, PGM_P content_type, PGM_P content) { send(code, content_type, content); }
+    void send_P(int code, PGM_P content_type, PGM_P content, size_t contentLength) {
+      send(code, content_type, content, contentLength);
+    }
+
+    void sendContent(const String& content) { sendContent(content.c_str(), content.length()); }
+    void sendContent(const char* content) { sendContent(content, strlen(content)); }
+    void sendContent(const char* content, size_t size) {
+      if (_chunked) {
+        char chunkSize[20];
+        snprintf(chunkSize, sizeof(chunkSize), "%zx\r\n", size);
+        _currentClient.write(chunkSize, strlen(chunkSize));
+      }
+      _currentClient.write((const uint8_t*)content, size);
+      if (_chunked) {
+        _currentClient.write("\r\n", 2);
+        if (size == 0) _chunked = false;
+      }
+    }
+    void sendContent_P(PGM_P content) { sendContent(content); }
+    void sendContent_P(PGM_P content, size_t size) { sendContent(content, size); }
+
+    template <typename T>
+    size_t streamFile(T& file, const String& contentType, const int code = 200) {
+      setContentLength(file.size());
+      send(code, contentType, emptyString);
+      return _currentClient.write(file);
+    }
+
+    // --- Simulation side ---
+
+    std::shared_ptr<SimConnection> simRequest(const SimHttpRequest& req) {
+      std::shared_ptr<SimConnection> conn;
+      {
+        sim::Untracked untracked;
+        conn = std::make_shared<SimConnection>();
+      }
+      _currentClient = WiFiClient(conn);
+      _method = req.method;
+      _args.clear();
+      _headers.clear();
+      _responseHeaders = String();
+      _contentLength = CONTENT_LENGTH_NOT_SET;
+      _chunked = false;
+
+      int q = req.uri.indexOf('?');
+      _uri = q < 0 ? req.uri : req.uri.substring(0, q);
+      if (q >= 0) parseArgs(req.uri.substring(q + 1));
+      for (const auto& h : req.headers) {
+        for (const auto& key : _collect) {
+          if (key.equalsIgnoreCase(h.first)) _headers.push_back(h);
+        }
+      }
+
+      const Route* route = nullptr;
+      for (const auto& r : _routes) {
+        if (r.uri == _uri && (r.method == HTTP_ANY || r.method == _method)) { route = &r; break; }
+      }
+
+      if (req.uploadFilename.length() > 0) {
+        deliverUpload(req, route && route->ufn ? route->ufn : _fileUpload);
+      } else if (!req.body.empty()) {
+        {
+          sim::Untracked untracked;
+          conn->request = req.body;
+        }
+        parseArgs(String((const char*)req.body.data(), req.body.size()));
+      }
+
+      if (route) route->fn();
+      else if (_notFound) _notFound();
+      else send(404, "text/plain", "Not found");
+
+      if (_chunked) sendContent("");
+      _currentClient = WiFiClient();
+      if (conn.use_count() == 1) conn->open = false;  // nobody kept the client: close like the core does
+      return conn;
+    }
+
+    std::shared_ptr<SimConnection> simGet(const String& uri, std::vector<std::pair<String, String>> headers = {}) {
+      SimHttpRequest req;
+      req.uri = uri;
+      req.headers = std::move(headers);
+      return simRequest(req);
+    }
+
+  private:
+    struct Route {
+      String uri;
+      HTTPMethod method;
+      THandlerFunction fn;
+      THandlerFunction ufn;
+    };
+
+    int _port;
+    std::vector<Route> _routes;
+    THandlerFunction _notFound;
+    THandlerFunction _fileUpload;
+    std::vector<String> _collect;
+
+    WiFiClient _currentClient;
+    String _uri;
+    HTTPMethod _method = HTTP_GET;
+    std::vector<std::pair<String, String>> _args;
+    std::vector<std::pair<String, String>> _headers;
+    String _responseHeaders;
+    size_t _contentLength = CONTENT_LENGTH_NOT_SET;
+    bool _chunked = false;
+    std::unique_ptr<HTTPUpload> _upload;
+
+    static const char* statusText(int code) {
+      switch (code) {
+        case 200: return "OK";
+        case 204: return "No Content";
+        case 206: return "Partial Content";
+        case 301: return "Moved Permanently";
+        case 302: return "Found";
+        case 303: return "See Other";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 412: return "Precondition Failed";
+        case 413: return "Payload Too Large";
+        case 416: return "Range Not Satisfiable";
+        case 500: return "Internal Server Error";
+        case 503: return "Service Unavailable";
+        default: return "";
+      }
+    }
+
+    void sendBody(int code, const char* content_type, const uint8_t* content, size_t length) {
+      String header = "HTTP/1.1 " + String(code) + " " + statusText(code) + "\r\n";
+      if (content_type && *content_type) header += String("Content-Type: ") + content_type + "\r\n";
+      if (_contentLength == CONTENT_LENGTH_NOT_SET) _contentLength = length;
+      if (_contentLength == CONTENT_LENGTH_UNKNOWN) {
+        header += "Transfer-Encoding: chunked\r\n";
+        _chunked = true;
+      } else {
+        header += "Content-Length: " + String((unsigned long)_contentLength) + "\r\n";
+      }
+      header += _responseHeaders;
+      header += "Connection: close\r\n\r\n";
+      _responseHeaders = String();
+      _currentClient.write((const uint8_t*)header.c_str(), header.length());
+      if (length) sendContent((const char*)content, length);
+    }
+
+    static String urlDecode(const String& in) {
+      String out;
+      for (unsigned int i = 0; i < in.length(); i++) {
+        char c = in[i];
+        if (c == '+') out += ' ';
+        else if (c == '%' && i + 2 < in.length()) {
+          char hex[3] = {in[i + 1], in[i + 2], 0};
+          out += (char)strtol(hex, nullptr, 16);
+          i += 2;
+        } else out += c;
+      }
+      return out;
+    }
+
+    void parseArgs(const String& query) {
+      unsigned int pos = 0;
+      while (pos <= query.length()) {
+        int amp = query.indexOf('&', pos);
+        String pair = query.substring(pos, amp < 0 ? query.length() : (unsigned int)amp);
+        if (pair.length()) {
+          int eq = pair.indexOf('=');
+          if (eq < 0) _args.push_back({urlDecode(pair), String()});
+          else _args.push_back({urlDecode(pair.substring(0, eq)), urlDecode(pair.substring(eq + 1))});
+        }
+        if (amp < 0) break;
+        pos = amp + 1;
+      }
+    }
+
+    void deliverUpload(const SimHttpRequest& req, THandlerFunction ufn) {
+      if (!ufn) return;
+      _upload.reset(new HTTPUpload());
+      _upload->filename = req.uploadFilename;
+      _upload->name = "file";
+      _upload->type = "application/octet-stream";
+      _upload->totalSize = 0;
+      _upload->currentSize = 0;
+      _upload->contentLength = req.body.size();
+      _upload->status = UPLOAD_FILE_START;
+      ufn();
+      size_t pos = 0;
+      while (pos < req.body.size()) {
+        size_t n = std::min((size_t)HTTP_UPLOAD_BUFLEN, req.body.size() - pos);
+        memcpy(_upload->buf, req.body.data() + pos, n);
+        _upload->currentSize = n;
+        _upload->status = UPLOAD_FILE_WRITE;
+        ufn();
+        _upload->totalSize += n;
+        pos += n;
+      }
+      _upload->currentSize = 0;
+      _upload->status = UPLOAD_FILE_END;
+      ufn();
+    }
+};
+
+inline SimHttpResponse simParseResponse(const SimConnection& conn) {
+  sim::Untracked untracked;
+  SimHttpResponse res;
+  const std::vector<uint8_t>& raw = conn.sent;
+  size_t pos = 0;
+  auto readLine = [&](String& line) {
+    line = String();
+    while (pos < raw.size()) {
+      char c = (char)raw[pos++];
+      if (c == '\n') break;
+      if (c != '\r') line += c;
+    }
+  };
+  String line;
+  readLine(line);
+  int sp = line.indexOf(' ');
+  if (sp > 0) res.status = (int)line.substring(sp + 1).toInt();
+  while (pos < raw.size()) {
+    readLine(line);
+    if (line.length() == 0) break;
+    int colon = line.indexOf(':');
+    if (colon > 0) {
+      String value = line.substring(colon + 1);
+      value.trim();
+      res.headers.push_back({line.substring(0, colon), value});
+    }
+  }
+  res.chunked = res.header("Transfer-Encoding") == "chunked";
+  if (!res.chunked) {
+    res.body.assign(raw.begin() + pos, raw.end());
+    return res;
+  }
+  while (pos < raw.size()) {
+    readLine(line);
+    size_t size = strtoul(line.c_str(), nullptr, 16);
+    if (size == 0) break;
+    size = std::min(size, raw.size() - pos);
+    res.body.insert(res.body.end(), raw.begin() + pos, raw.begin() + pos + size);
+    pos += size + 2;
+  }
+  return res;
+}
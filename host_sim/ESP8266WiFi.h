@@ -0,0 +1,174 @@
+/*
+
+Host-side stand-in for ESP8266WiFi: an always-connected WiFi object and a WiFiClient that writes
+into an in-memory SimConnection instead of a TCP socket.
+
+SimConnection models the lwIP send path closely enough for throughput work:
+
+- every write() call costs writeCallUs of CPU (tcp_write/tcp_output, one small segment per call)
+  plus cpuPerByteUs per byte, charged to the virtual clock;
+- written bytes go into a send buffer of sndBufBytes (TCP_SND_BUF) that drains to the peer at
+  drainBytesPerUs in the background. availableForWrite() reports the free space; a write larger
+  than the free space blocks (advances the clock) until enough has drained.
+
+Everything written is kept in `sent`, with the time of the first and last byte, so callers can
+parse the HTTP response and compute time to first byte.
+
+Like the core's WiFiClient, copies share one connection; it stays open until stop() is called or
+the peer closes it.
+
+*/
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include "Arduino.h"
+
+#define WL_CONNECTED 3
+#define WL_DISCONNECTED 6
+
+class IPAddress : public Printable {
+  public:
+    IPAddress(uint8_t a = 0, uint8_t b = 0, uint8_t c = 0, uint8_t d = 0) : _b{a, b, c, d} {}
+    String toString() const {
+      char buf[16];
+      snprintf(buf, sizeof(buf), "%u.%u.%u.%u", _b[0], _b[1], _b[2], _b[3]);
+      return String(buf);
+    }
+    size_t printTo(Print& p) const override { return p.print(toString()); }
+
+  private:
+    uint8_t _b[4];
+};
+
+struct SimNetTiming {
+  uint32_t writeCallUs = 1000;
+  double cpuPerByteUs = 0.05;
+  size_t sndBufBytes = 2920;      // 2 * MSS, as in the core's low-memory lwIP build
+  double drainBytesPerUs = 0.6;   // ~600 KB/s to the peer
+};
+
+struct SimConnection {
+  SimNetTiming timing;
+  std::vector<uint8_t> sent;     // raw bytes the sketch wrote (HTTP response)
+  std::vector<uint8_t> request;  // bytes the peer sends (request body), read by the sketch
+  size_t requestPos = 0;
+  bool open = true;
+  uint32_t writeCalls = 0;
+  uint64_t openedUs = 0;
+  uint64_t firstByteUs = 0;
+  uint64_t lastByteUs = 0;
+  uint64_t netUs = 0;            // time the sketch spent inside write() calls
+
+  SimConnection() : openedUs(sim::nowUs) {}
+
+  size_t queued() {
+    uint64_t drained = (uint64_t)((double)(sim::nowUs - _queueStampUs) * timing.drainBytesPerUs);
+    _queued = drained >= _queued ? 0 : _queued - (size_t)drained;
+    _queueStampUs = sim::nowUs;
+    return _queued;
+  }
+
+  size_t freeSpace() {
+    size_t q = queued();
+    return q >= timing.sndBufBytes ? 0 : timing.sndBufBytes - q;
+  }
+
+  size_t write(const uint8_t* buf, size_t size) {
+    if (!open) return 0;
+    if (size == 0) return 0;
+    sim::Untracked untracked;
+    uint64_t start = sim::nowUs;
+    size_t done = 0;
+    while (done < size) {
+      size_t room = freeSpace();
+      if (room == 0) {
+        // Block until one MSS worth has drained
+        sim::advanceUs((uint64_t)(std::min<size_t>(1460, timing.sndBufBytes) / timing.drainBytesPerUs) + 1);
+        continue;
+      }
+      size_t n = std::min(room, size - done);
+      sim::advanceUs(timing.writeCallUs + (uint64_t)(n * timing.cpuPerByteUs));
+      queued();
+      _queued += n;
+      if (sent.empty()) firstByteUs = sim::nowUs;
+      sent.insert(sent.end(), buf + done, buf + done + n);
+      lastByteUs = sim::nowUs;
+      writeCalls++;
+      done += n;
+    }
+    netUs += sim::nowUs - start;
+    return done;
+  }
+
+  // Virtual time at which everything written so far has reached the peer.
+  uint64_t drainedAtUs() {
+    return sim::nowUs + (uint64_t)((double)queued() / timing.drainBytesPerUs);
+  }
+
+ private:
+  size_t _queued = 0;
+  uint64_t _queueStampUs = sim::nowUs;
+};
+
+class WiFiClient : public Stream {
+  public:
+    WiFiClient() {}
+    explicit WiFiClient(std::shared_ptr<SimConnection> conn) : _conn(std::move(conn)) {}
+
+    uint8_t connected() { return _conn && _conn->open; }
+    operator bool() { return _conn && _conn->open; }
+    bool operator==(const WiFiClient& rhs) const { return _conn == rhs._conn; }
+    bool operator!=(const WiFiClient& rhs) const { return _conn != rhs._conn; }
+
+    size_t write(uint8_t b) override { return write(&b, 1); }
+    size_t write(const uint8_t* buf, size_t size) override { return _conn ? _conn->write(buf, size) : 0; }
+    using Print::write;
+    size_t write(Stream& stream) {
+      uint8_t buf[1460];
+      size_t total = 0;
+      int n;
+      while ((n = stream.read(buf, sizeof(buf))) > 0) {
+        size_t w = write(buf, (size_t)n);
+        total += w;
+        if (w < (size_t)n) break;
+      }
+      return total;
+    }
+    int availableForWrite() override { return _conn && _conn->open ? (int)_conn->freeSpace() : 0; }
+    void flush() override {}
+    bool flush(unsigned int) { return true; }
+    void stop() { if (_conn) _conn->open = false; }
+    bool stop(unsigned int) { stop(); return true; }
+    void setNoDelay(bool) {}
+    void setTimeout(unsigned long t) { Stream::setTimeout(t); }
+
+    int available() override { return _conn ? (int)(_conn->request.size() - _conn->requestPos) : 0; }
+    int read() override { return available() > 0 ? _conn->request[_conn->requestPos++] : -1; }
+    int read(uint8_t* buf, size_t size) override {
+      size_t n = std::min(size, (size_t)std::max(available(), 0));
+      for (size_t i = 0; i < n; i++) buf[i] = _conn->request[_conn->requestPos++];
+      return (int)n;
+    }
+    int peek() override { return available() > 0 ? _conn->request[_conn->requestPos] : -1; }
+
+    IPAddress remoteIP() const { return IPAddress(192, 168, 4, 2); }
+    uint16_t remotePort() const { return 50000; }
+
+    std::shared_ptr<SimConnection> simConnection() const { return _conn; }
+
+  private:
+    std::shared_ptr<SimConnection> _conn;
+};
+
+class ESP8266WiFiClass {
+  public:
+    int begin(const char*, const char* = nullptr) { return WL_CONNECTED; }
+    int status() { return WL_CONNECTED; }
+    IPAddress localIP() { return IPAddress(192, 168, 4, 1); }
+    void mode(int) {}
+    void setSleepMode(int) {}
+};
+
+inline ESP8266WiFiClass WiFi;
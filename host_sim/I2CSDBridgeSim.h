@@ -0,0 +1,473 @@
+/*
+
+Host-side model of the I2C SD-card bridge at 0x6e, backed by a directory on the workstation.
+
+The bridge is a byte-oriented command device: a write transaction starts with a command byte,
+optionally followed by arguments, and the bytes the master then reads depend on the last command.
+
+- 'F' + path     Select a path for the commands that follow.
+- 'S'            Read 4 bytes: size of the selected file, MSB first (0 if missing or a directory).
+- 'R'            Read the selected file from offset 0, as many bytes as the master clocks out.
+- 'O' + 4 bytes  Like 'R', but start at the given offset (MSB first). Past the end of the file reads return 0xFF.
+- 'G' + 4 bytes  Like 'O', but in frames of 32 bytes, one per requestFrom(): 30 data bytes (0xFF past the end of the
+                 file, or if no file is selected) and a CRC-16/CCITT (poly 0x1021, init 0xFFFF, MSB first) over the
+                 frame's file offset (4 bytes, MSB first) followed by the 30 data bytes.
+- 'L'            Read the selected directory: per entry Type('F'/'D'), Name, '\0', Size (4 bytes, LSB first); 0xFF ends the list.
+- 'N' + 4 bytes  Like 'L', but start at the entry with the given index (MSB first). The bridge walks the entries
+                 before it without sending them; past the last entry the list is just the 0xFF end marker.
+- 'T'            Read 4 bytes: last modification of the selected file as FAT date (2 bytes) and FAT time (2 bytes),
+                 MSB first; 0 if the file does not exist. Files written over the bus get the bridge clock set by 'C'.
+- 'I' + path     Select a path like 'F' and read 9 bytes about it: flags (1 = existing file, 2 = existing directory),
+                 then what 'S' and 'T' return, so opening a file for serving takes one round trip.
+- 'E' / 'K'      Read 1 byte: 1 if the selected path is an existing file / directory.
+- 'X' / 'M' / 'D' Read 1 byte: 1 if removing the file / making the directory / removing the (empty) directory succeeded.
+- 'Q'            Read 1 byte: card type (3 = SDHC/SDXC).
+- 'V'            Read 10 bytes: Status, FAT type, Blocks per cluster (4, LSB first), Cluster count (4, LSB first).
+- 'C' + 6 bytes  Set the bridge clock (YY, MM, DD, hh, mm, ss).
+- 'W' / 'A' + data Write (truncate) / append the payload to the selected file.
+
+Timing: work the bridge does while the master is clocking (opening a file, fetching the next
+512-byte SD block, walking the directory) is reported back through takeStretchUs() and charged to
+the bus as clock stretching. Writes are committed after STOP, and the bridge NACKs its address until
+the SD card has finished (busyUntilUs), which is what the sketch's CustDelay(5) calls wait out.
+
+Faults: nackRate NACKs a transaction's address phase, bitErrorRate flips one bit of a byte read by
+the master. maxCleanClockHz models marginal wiring: above that bus clock the overClock rates are
+added to both. probeDropsReply models bridge firmware that drops a reply still waiting to be read when
+an address-only probe arrives. All draw from a seeded generator so runs are reproducible.
+
+*/
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <random>
+#include <map>
+#include <chrono>
+#include <ctime>
+#include <cstdio>
+#include <cstdint>
+#include "Arduino.h"
+
+struct I2CSDBridgeTiming {
+  uint32_t commandUs = 60;           // decoding a write transaction
+  uint32_t fsOpenUs = 700;           // FAT lookup behind 'S', 'E', 'K', 'L', 'N', 'R', 'I'
+  uint32_t sdBlockReadUs = 900;      // fetching one 512-byte block during 'R'
+  uint32_t seekUs = 400;             // following the cluster chain to the offset of an 'O' / 'G'
+  uint32_t frameCrcUs = 30;          // checksumming one 'G' frame
+  uint32_t dirEntryUs = 120;         // reading one directory entry during 'L' (or skipping one for 'N')
+  uint32_t fsModifyUs = 2500;        // 'X', 'M', 'D'
+  uint32_t writeBusyUs = 1800;       // committing a 'W'/'A' chunk (address NACKed meanwhile)
+  uint32_t writeBusyPerByteUs = 15;
+};
+
+struct I2CSDBridgeFaults {
+  double nackRate = 0.0;      // probability that a transaction's address byte is NACKed
+  double bitErrorRate = 0.0;  // probability that a byte read by the master has one bit flipped
+  uint32_t maxCleanClockHz = 0;     // fastest clock the wiring carries cleanly, 0 = any
+  double overClockNackRate = 0.05;  // added above maxCleanClockHz
+  double overClockBitErrorRate = 0.05;
+  bool probeDropsReply = false;     // firmware that forgets a pending reply when an address-only probe arrives
+  uint32_t seed = 1;
+};
+
+struct I2CSDBridgeStats {
+  uint32_t commands[128] = {0};  // write transactions per command byte
+  uint32_t busyNacks = 0;        // address NACKs because a write was still being committed
+  uint32_t injectedNacks = 0;
+  uint32_t injectedBitErrors = 0;
+  uint64_t fileBytesRead = 0;
+  uint64_t fileBytesWritten = 0;
+
+  void reset() { *this = I2CSDBridgeStats(); }
+};
+
+class I2CSDBridgeSim {
+  public:
+    I2CSDBridgeTiming timing;
+    I2CSDBridgeFaults faults;
+    I2CSDBridgeStats stats;
+
+    explicit I2CSDBridgeSim(uint8_t address = 0x6e) : _address(address), _rng(1) {}
+    ~I2CSDBridgeSim() { closeFile(); }
+
+    // Serve the card from rootDir (created if missing). Returns false if it cannot be used.
+    bool begin(const std::string& rootDir) {
+      std::error_code ec;
+      std::filesystem::create_directories(rootDir, ec);
+      _root = std::filesystem::absolute(rootDir, ec);
+      _rng.seed(faults.seed);
+      resetState();
+      return std::filesystem::is_directory(_root, ec);
+    }
+
+    void setFaults(const I2CSDBridgeFaults& f) { faults = f; _rng.seed(f.seed); }
+    void setBusClock(uint32_t hz) { _busClockHz = hz; }  // kept up to date by Wire for the overClock faults
+    uint8_t address() const { return _address; }
+    const std::filesystem::path& root() const { return _root; }
+    const std::string& selectedPath() const { return _path; }
+
+    // --- Bus-facing side, driven by TwoWire ---
+
+    // Address phase of a transaction. false = NACK.
+    bool ackAddress() {
+      if (sim::nowUs < _busyUntilUs) {
+        stats.busyNacks++;
+        return false;
+      }
+      double nackRate = faults.nackRate + (overClocked() ? faults.overClockNackRate : 0);
+      if (nackRate > 0 && chance(nackRate)) {
+        stats.injectedNacks++;
+        return false;
+      }
+      return true;
+    }
+
+    // A complete write transaction (command byte + arguments), delivered at STOP / repeated START.
+    void receive(const uint8_t* data, size_t len) {
+      if (len == 0) {  // address-only probe, state is unchanged
+        if (faults.probeDropsReply && _output == Output::Buffer) respondBytes({});
+        return;
+      }
+      sim::Untracked untracked;
+      uint8_t cmd = data[0];
+      const uint8_t* arg = data + 1;
+      size_t argLen = len - 1;
+      stats.commands[cmd & 0x7f]++;
+      _stretchUs += timing.commandUs;
+      switch (cmd) {
+        case 'F': selectPath(std::string((const char*)arg, argLen)); break;
+        case 'S': respondSize(); break;
+        case 'T': respondModified(); break;
+        case 'I': respondInfo(std::string((const char*)arg, argLen)); break;
+        case 'R': openForRead(0); break;
+        case 'O': openForRead(offsetArg(arg, argLen)); break;
+        case 'G': openFramed(offsetArg(arg, argLen)); break;
+        case 'L': respondListing(0); break;
+        case 'N': respondListing(offsetArg(arg, argLen)); break;
+        case 'E': respondFlag(isFile(_path)); break;
+        case 'K': respondFlag(isDir(_path)); break;
+        case 'X': _stretchUs += timing.fsModifyUs; respondFlag(removeFile()); break;
+        case 'M': _stretchUs += timing.fsModifyUs; respondFlag(makeDir()); break;
+        case 'D': _stretchUs += timing.fsModifyUs; respondFlag(removeDir()); break;
+        case 'Q': respondBytes({3}); break;
+        case 'V': respondVolume(); break;
+        case 'C': setClock(arg, argLen); break;
+        case 'W':
+        case 'A': writeData(cmd == 'A', arg, argLen); break;
+        default: respondBytes({}); break;  // unknown command: reads return 0xFF
+      }
+    }
+
+    // One byte clocked out by the master.
+    uint8_t transmit() {
+      sim::Untracked untracked;
+      uint8_t b = nextByte();
+      double bitErrorRate = faults.bitErrorRate + (overClocked() ? faults.overClockBitErrorRate : 0);
+      if (bitErrorRate > 0 && chance(bitErrorRate)) {
+        b ^= (uint8_t)(1u << (_rng() % 8));
+        stats.injectedBitErrors++;
+      }
+      return b;
+    }
+
+    // Processing time accumulated since the last call, charged to the bus as clock stretching.
+    uint32_t takeStretchUs() {
+      uint32_t us = _stretchUs;
+      _stretchUs = 0;
+      return us;
+    }
+
+    // --- Host-side helpers for benchmarks ---
+
+    std::filesystem::path hostPath(const std::string& cardPath) const {
+      std::filesystem::path p = _root;
+      size_t start = 0;
+      while (start < cardPath.size()) {
+        size_t end = cardPath.find('/', start);
+        if (end == std::string::npos) end = cardPath.size();
+        std::string part = cardPath.substr(start, end - start);
+        if (!part.empty() && part != "." && part != "..") p /= part;
+        start = end + 1;
+      }
+      return p;
+    }
+
+    bool writeHostFile(const std::string& cardPath, const std::vector<uint8_t>& data) {
+      std::filesystem::path p = hostPath(cardPath);
+      std::error_code ec;
+      std::filesystem::create_directories(p.parent_path(), ec);
+      _modified.erase(p.string());
+      FILE* f = fopen(p.string().c_str(), "wb");
+      if (!f) return false;
+      size_t n = data.empty() ? 0 : fwrite(data.data(), 1, data.size(), f);
+      fclose(f);
+      return n == data.size();
+    }
+
+  private:
+    enum class Output { None, Buffer, File, Frames };
+
+    uint8_t _address;
+    std::filesystem::path _root;
+    std::string _path;
+    std::mt19937 _rng;
+    uint32_t _stretchUs = 0;
+    uint64_t _busyUntilUs = 0;
+    uint8_t _clock[6] = {0};
+    std::map<std::string, uint32_t> _modified;  // FAT date/time of files written over the bus
+
+    Output _output = Output::None;
+    std::vector<uint8_t> _out;
+    size_t _outPos = 0;
+    std::vector<size_t> _entryStarts;  // offsets of directory entries inside _out
+    size_t _nextEntry = 0;
+
+    FILE* _file = nullptr;
+    uint8_t _block[512];
+    size_t _blockLen = 0;
+    size_t _blockPos = 0;
+    uint32_t _busClockHz = 100000;
+    uint8_t _frame[32];
+    size_t _framePos = 0;
+    uint32_t _frameOffset = 0;
+
+    bool overClocked() const { return faults.maxCleanClockHz > 0 && _busClockHz > faults.maxCleanClockHz; }
+    bool chance(double p) { return std::uniform_real_distribution<double>(0.0, 1.0)(_rng) < p; }
+
+    void resetState() {
+      closeFile();
+      _output = Output::None;
+      _out.clear();
+      _outPos = 0;
+      _entryStarts.clear();
+      _nextEntry = 0;
+      _busyUntilUs = 0;
+      _stretchUs = 0;
+    }
+
+    void closeFile() {
+      if (_file) fclose(_file);
+      _file = nullptr;
+      _blockLen = _blockPos = 0;
+    }
+
+    bool isFile(const std::string& path) const {
+      std::error_code ec;
+      return std::filesystem::is_regular_file(hostPath(path), ec);
+    }
+    bool isDir(const std::string& path) const {
+      std::error_code ec;
+      return std::filesystem::is_directory(hostPath(path), ec);
+    }
+
+    void selectPath(const std::string& path) {
+      closeFile();
+      _path = path;
+      respondBytes({});
+    }
+
+    void respondBytes(std::initializer_list<uint8_t> bytes) {
+      closeFile();
+      _out.assign(bytes.begin(), bytes.end());
+      _outPos = 0;
+      _entryStarts.clear();
+      _nextEntry = 0;
+      _output = Output::Buffer;
+    }
+
+    void respondFlag(bool value) {
+      _stretchUs += timing.fsOpenUs;
+      respondBytes({(uint8_t)(value ? 1 : 0)});
+    }
+
+    void respondSize() {
+      _stretchUs += timing.fsOpenUs;
+      std::error_code ec;
+      uint32_t size = isFile(_path) ? (uint32_t)std::filesystem::file_size(hostPath(_path), ec) : 0;
+      respondBytes({(uint8_t)(size >> 24), (uint8_t)(size >> 16), (uint8_t)(size >> 8), (uint8_t)size});
+    }
+
+    static uint32_t fatDateTime(int year, int month, int day, int hour, int minute, int second) {
+      if (year < 1980) year = 1980;
+      return ((uint32_t)(year - 1980) << 25) | ((uint32_t)month << 21) | ((uint32_t)day << 16) |
+             ((uint32_t)hour << 11) | ((uint32_t)minute << 5) | (uint32_t)(second / 2);
+    }
+
+    void respondModified() {
+      _stretchUs += timing.fsOpenUs;
+      uint32_t stamp = modifiedStamp();
+      respondBytes({(uint8_t)(stamp >> 24), (uint8_t)(stamp >> 16), (uint8_t)(stamp >> 8), (uint8_t)stamp});
+    }
+
+    // One directory lookup answers all three
+    void respondInfo(const std::string& path) {
+      selectPath(path);
+      _stretchUs += timing.fsOpenUs;
+      bool file = isFile(_path);
+      uint8_t flags = file ? 1 : isDir(_path) ? 2 : 0;
+      std::error_code ec;
+      uint32_t size = file ? (uint32_t)std::filesystem::file_size(hostPath(_path), ec) : 0;
+      uint32_t stamp = modifiedStamp();
+      respondBytes({flags, (uint8_t)(size >> 24), (uint8_t)(size >> 16), (uint8_t)(size >> 8), (uint8_t)size,
+                    (uint8_t)(stamp >> 24), (uint8_t)(stamp >> 16), (uint8_t)(stamp >> 8), (uint8_t)stamp});
+    }
+
+    uint32_t modifiedStamp() {
+      uint32_t stamp = 0;
+      if (isFile(_path)) {
+        auto it = _modified.find(hostPath(_path).string());
+        if (it != _modified.end()) {
+          stamp = it->second;
+        } else {
+          std::error_code ec;
+          auto ft = std::filesystem::last_write_time(hostPath(_path), ec);
+          auto sys = std::chrono::system_clock::now() +
+                     std::chrono::duration_cast<std::chrono::system_clock::duration>(ft - std::filesystem::file_time_type::clock::now());
+          std::time_t t = std::chrono::system_clock::to_time_t(sys);
+          std::tm tm = *std::gmtime(&t);
+          stamp = fatDateTime(tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+        }
+      }
+      return stamp;
+    }
+
+    void respondVolume() {
+      const uint32_t blocksPerCluster = 64;
+      const uint32_t clusters = 262144;  // 8 GB card
+      respondBytes({0x01, 32,
+                    (uint8_t)blocksPerCluster, (uint8_t)(blocksPerCluster >> 8), (uint8_t)(blocksPerCluster >> 16), (uint8_t)(blocksPerCluster >> 24),
+                    (uint8_t)clusters, (uint8_t)(clusters >> 8), (uint8_t)(clusters >> 16), (uint8_t)(clusters >> 24)});
+    }
+
+    void respondListing(uint32_t first) {
+      respondBytes({});
+      _stretchUs += timing.fsOpenUs;
+      std::error_code ec;
+      std::filesystem::path dir = hostPath(_path);
+      std::vector<std::filesystem::directory_entry> entries;
+      if (std::filesystem::is_directory(dir, ec)) {
+        for (const auto& e : std::filesystem::directory_iterator(dir, ec)) entries.push_back(e);
+      }
+      std::sort(entries.begin(), entries.end(),
+                [](const auto& a, const auto& b) { return a.path().filename() < b.path().filename(); });
+      size_t skip = std::min<size_t>(first, entries.size());
+      _stretchUs += skip * timing.dirEntryUs;  // walked on the card, not sent
+      entries.erase(entries.begin(), entries.begin() + skip);
+      for (const auto& e : entries) {
+        bool dirEntry = e.is_directory(ec);
+        uint32_t size = dirEntry ? 0 : (uint32_t)e.file_size(ec);
+        std::string name = e.path().filename().string();
+        _entryStarts.push_back(_out.size());
+        _out.push_back(dirEntry ? 'D' : 'F');
+        _out.insert(_out.end(), name.begin(), name.end());
+        _out.push_back(0);
+        for (int i = 0; i < 4; i++) _out.push_back((uint8_t)(size >> (8 * i)));
+      }
+      _out.push_back(0xFF);
+    }
+
+    void openForRead(uint32_t offset) {
+      respondBytes({});
+      _stretchUs += timing.fsOpenUs;
+      if (!isFile(_path)) return;
+      _file = fopen(hostPath(_path).string().c_str(), "rb");
+      _output = _file ? Output::File : Output::Buffer;
+      if (_file && offset > 0) {
+        _stretchUs += timing.seekUs;
+        fseek(_file, offset, SEEK_SET);
+      }
+    }
+
+    static uint32_t offsetArg(const uint8_t* arg, size_t argLen) {
+      return argLen >= 4 ? ((uint32_t)arg[0] << 24) | ((uint32_t)arg[1] << 16) | ((uint32_t)arg[2] << 8) | arg[3] : 0;
+    }
+
+    void openFramed(uint32_t offset) {
+      openForRead(offset);
+      _output = Output::Frames;
+      _frameOffset = offset;
+      _framePos = sizeof(_frame);  // the first byte read builds the first frame
+    }
+
+    void buildFrame() {
+      const size_t data = sizeof(_frame) - 2;
+      for (size_t i = 0; i < data; i++) _frame[i] = fileByte();
+      uint8_t offset[4] = { (uint8_t)(_frameOffset >> 24), (uint8_t)(_frameOffset >> 16), (uint8_t)(_frameOffset >> 8), (uint8_t)_frameOffset };
+      uint16_t crc = crc16(crc16(0xFFFF, offset, 4), _frame, data);
+      _frame[data] = (uint8_t)(crc >> 8);
+      _frame[data + 1] = (uint8_t)crc;
+      _frameOffset += data;
+      _framePos = 0;
+      _stretchUs += timing.frameCrcUs;
+    }
+
+    static uint16_t crc16(uint16_t crc, const uint8_t* data, size_t len) {
+      while (len--) {
+        crc ^= (uint16_t)*data++ << 8;
+        for (int i = 0; i < 8; i++) crc = crc & 0x8000 ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+      }
+      return crc;
+    }
+
+    uint8_t fileByte() {
+      if (!_file) return 0xFF;
+      if (_blockPos >= _blockLen) {
+        _blockLen = fread(_block, 1, sizeof(_block), _file);
+        _blockPos = 0;
+        if (_blockLen == 0) return 0xFF;
+        _stretchUs += timing.sdBlockReadUs;
+      }
+      stats.fileBytesRead++;
+      return _block[_blockPos++];
+    }
+
+    uint8_t nextByte() {
+      if (_output == Output::File) return fileByte();
+      if (_output == Output::Frames) {
+        if (_framePos >= sizeof(_frame)) buildFrame();
+        return _frame[_framePos++];
+      }
+      if (_output == Output::Buffer && _outPos < _out.size()) {
+        if (_nextEntry < _entryStarts.size() && _outPos == _entryStarts[_nextEntry]) {
+          _stretchUs += timing.dirEntryUs;
+          _nextEntry++;
+        }
+        return _out[_outPos++];
+      }
+      return 0xFF;  // nothing to send: the bus idles high
+    }
+
+    bool removeFile() {
+      std::error_code ec;
+      _modified.erase(hostPath(_path).string());
+      return isFile(_path) && std::filesystem::remove(hostPath(_path), ec);
+    }
+    bool makeDir() {
+      std::error_code ec;
+      return std::filesystem::create_directory(hostPath(_path), ec);
+    }
+    bool removeDir() {
+      std::error_code ec;
+      return isDir(_path) && std::filesystem::is_empty(hostPath(_path), ec) && std::filesystem::remove(hostPath(_path), ec);
+    }
+
+    void setClock(const uint8_t* arg, size_t len) {
+      for (size_t i = 0; i < sizeof(_clock) && i < len; i++) _clock[i] = arg[i];
+      respondBytes({});
+    }
+
+    void writeData(bool append, const uint8_t* data, size_t len) {
+      respondBytes({});
+      if (isDir(_path)) return;
+      FILE* f = fopen(hostPath(_path).string().c_str(), append ? "ab" : "wb");
+      if (!f) return;
+      fwrite(data, 1, len, f);
+      fclose(f);
+      _modified[hostPath(_path).string()] = fatDateTime(2000 + _clock[0], _clock[1] ? _clock[1] : 1, _clock[2] ? _clock[2] : 1,
+                                                        _clock[3], _clock[4], _clock[5]);
+      stats.fileBytesWritten += len;
+      _busyUntilUs = sim::nowUs + timing.writeBusyUs + (uint64_t)timing.writeBusyPerByteUs * len;
+    }
+};
@@ -0,0 +1,49 @@
+/*
+
+Global operator new/delete replacements that keep sim::heapInUse / sim::heapPeak up to date,
+so ESP.getFreeHeap() in the simulator moves with the sketch's String and vector allocations
+and benchmarks can report peak heap per operation. Allocations made under sim::Untracked
+(simulator bookkeeping) are not counted.
+
+Replacement allocation functions must be defined exactly once per program: include this header
+from the .cpp that contains main() and nowhere else.
+
+*/
+#pragma once
+
+#include <new>
+#include <cstdlib>
+#include "Arduino.h"
+
+namespace sim {
+  struct alignas(std::max_align_t) HeapHeader {
+    size_t size;
+    bool tracked;
+  };
+
+  inline void* heapAlloc(size_t size) {
+    HeapHeader* h = static_cast<HeapHeader*>(std::malloc(sizeof(HeapHeader) + size));
+    if (!h) throw std::bad_alloc();
+    h->size = size;
+    h->tracked = untrackedDepth == 0;
+    if (h->tracked) {
+      heapInUse += size;
+      if (heapInUse > heapPeak) heapPeak = heapInUse;
+    }
+    return h + 1;
+  }
+
+  inline void heapFree(void* p) {
+    if (!p) return;
+    HeapHeader* h = static_cast<HeapHeader*>(p) - 1;
+    if (h->tracked) heapInUse -= h->size;
+    std::free(h);
+  }
+}
+
+void* operator new(size_t size) { return sim::heapAlloc(size); }
+void* operator new[](size_t size) { return sim::heapAlloc(size); }
+void operator delete(void* p) noexcept { sim::heapFree(p); }
+void operator delete[](void* p) noexcept { sim::heapFree(p); }
+void operator delete(void* p, size_t) noexcept { sim::heapFree(p); }
+void operator delete[](void* p, size_t) noexcept { sim::heapFree(p); }
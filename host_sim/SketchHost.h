@@ -0,0 +1,35 @@
+/*
+
+Builds the sketch itself (ESP8266_i2c-sdcard_webserver.ino and everything it includes) against the
+host stand-ins, and owns the simulated bridge it talks to.
+
+Usage from a host program:
+
+  sim::bridge.begin("/tmp/card");   // directory that plays the SD card
+  Wire.attach(&sim::bridge);
+  setup();                          // the sketch's own setup(): probes the bridge, registers routes
+  auto conn = server.simGet("/listSDCard?DIR=/");
+  sim::runLoopUntilClosed(*conn);   // keep calling loop() while anything is still being sent
+
+*/
+#pragma once
+
+#include "Arduino.h"
+#include "Wire.h"
+#include "ESP8266WiFi.h"
+#include "ESP8266WebServer.h"
+#include "I2CSDBridgeSim.h"
+
+#include "../ESP8266_i2c-sdcard_webserver/ESP8266_i2c-sdcard_webserver.ino"
+
+namespace sim {
+  inline I2CSDBridgeSim bridge(I2C_SDCARD);
+
+  // Calls the sketch's loop() until the connection is closed or maxIterations is reached.
+  inline void runLoopUntilClosed(SimConnection& conn, uint32_t maxIterations = 1000000) {
+    while (conn.open && maxIterations--) {
+      loop();
+      yield();
+    }
+  }
+}
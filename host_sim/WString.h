@@ -0,0 +1,190 @@
+/*
+
+Host-side stand-in for the Arduino String class (WString.h), backed by std::string.
+Only the subset used by the sketch is provided; behaviour follows the ESP8266 core
+(indexOf()/lastIndexOf() return -1 when nothing is found, substring() clamps its
+bounds, toInt() parses a leading decimal number and returns 0 otherwise).
+
+*/
+#pragma once
+
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <cstdint>
+
+class __FlashStringHelper;
+#ifndef F
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper*>(string_literal))
+#endif
+#ifndef FPSTR
+#define FPSTR(pstr_pointer) (reinterpret_cast<const __FlashStringHelper*>(pstr_pointer))
+#endif
+
+class String {
+  public:
+    String() {}
+    String(const char* cstr) { if (cstr) s_ = cstr; }
+    String(const char* cstr, size_t len) : s_(cstr, len) {}
+    String(const __FlashStringHelper* str) { if (str) s_ = reinterpret_cast<const char*>(str); }
+    String(const String& other) = default;
+    String(String&& other) = default;
+    explicit String(char c) : s_(1, c) {}
+    explicit String(unsigned char value, unsigned char base = 10) { s_ = toBase(value, base); }
+    explicit String(int value, unsigned char base = 10) { s_ = toSignedBase(value, base); }
+    explicit String(unsigned int value, unsigned char base = 10) { s_ = toBase(value, base); }
+    explicit String(long value, unsigned char base = 10) { s_ = toSignedBase(value, base); }
+    explicit String(unsigned long value, unsigned char base = 10) { s_ = toBase(value, base); }
+    explicit String(long long value, unsigned char base = 10) { s_ = toSignedBase(value, base); }
+    explicit String(unsigned long long value, unsigned char base = 10) { s_ = toBase(value, base); }
+    explicit String(float value, unsigned char decimalPlaces = 2) { s_ = toFixed(value, decimalPlaces); }
+    explicit String(double value, unsigned char decimalPlaces = 2) { s_ = toFixed(value, decimalPlaces); }
+
+    String& operator=(const String& rhs) = default;
+    String& operator=(String&& rhs) = default;
+    String& operator=(const char* cstr) { s_ = cstr ? cstr : ""; return *this; }
+    String& operator=(const __FlashStringHelper* str) { s_ = str ? reinterpret_cast<const char*>(str) : ""; return *this; }
+
+    unsigned char reserve(unsigned int size) { s_.reserve(size); return 1; }
+    unsigned int length() const { return (unsigned int)s_.size(); }
+    bool isEmpty() const { return s_.empty(); }
+    void clear() { s_.clear(); }
+    const char* c_str() const { return s_.c_str(); }
+    char* begin() { return &s_[0]; }
+    char* end() { return &s_[0] + s_.size(); }
+    const char* begin() const { return s_.data(); }
+    const char* end() const { return s_.data() + s_.size(); }
+
+    // concat
+    bool concat(const String& str) { s_ += str.s_; return true; }
+    bool concat(const char* cstr) { if (cstr) s_ += cstr; return true; }
+    bool concat(const char* cstr, unsigned int length) { s_.append(cstr, length); return true; }
+    bool concat(const __FlashStringHelper* str) { return concat(reinterpret_cast<const char*>(str)); }
+    bool concat(char c) { s_ += c; return true; }
+    bool concat(unsigned char num) { s_ += toBase(num, 10); return true; }
+    bool concat(int num) { s_ += toSignedBase(num, 10); return true; }
+    bool concat(unsigned int num) { s_ += toBase(num, 10); return true; }
+    bool concat(long num) { s_ += toSignedBase(num, 10); return true; }
+    bool concat(unsigned long num) { s_ += toBase(num, 10); return true; }
+    bool concat(long long num) { s_ += toSignedBase(num, 10); return true; }
+    bool concat(unsigned long long num) { s_ += toBase(num, 10); return true; }
+    bool concat(float num) { s_ += toFixed(num, 2); return true; }
+    bool concat(double num) { s_ += toFixed(num, 2); return true; }
+
+    template <typename T>
+    String& operator+=(const T& rhs) { concat(rhs); return *this; }
+    String& operator+=(const char* cstr) { concat(cstr); return *this; }
+
+    // comparison
+    int compareTo(const String& s) const { return s_.compare(s.s_); }
+    bool equals(const String& s) const { return s_ == s.s_; }
+    bool equals(const char* cstr) const { return s_ == (cstr ? cstr : ""); }
+    bool equalsIgnoreCase(const String& s) const {
+      if (s_.size() != s.s_.size()) return false;
+      for (size_t i = 0; i < s_.size(); i++) {
+        if (tolower((unsigned char)s_[i]) != tolower((unsigned char)s.s_[i])) return false;
+      }
+      return true;
+    }
+    bool operator==(const String& rhs) const { return equals(rhs); }
+    bool operator==(const char* cstr) const { return equals(cstr); }
+    bool operator!=(const String& rhs) const { return !equals(rhs); }
+    bool operator!=(const char* cstr) const { return !equals(cstr); }
+    bool operator<(const String& rhs) const { return s_ < rhs.s_; }
+    bool startsWith(const String& prefix) const { return s_.compare(0, prefix.s_.size(), prefix.s_) == 0; }
+    bool startsWith(const String& prefix, unsigned int offset) const {
+      return offset <= s_.size() && s_.compare(offset, prefix.s_.size(), prefix.s_) == 0;
+    }
+    bool endsWith(const String& suffix) const {
+      return s_.size() >= suffix.s_.size() && s_.compare(s_.size() - suffix.s_.size(), suffix.s_.size(), suffix.s_) == 0;
+    }
+
+    // character access
+    char charAt(unsigned int index) const { return index < s_.size() ? s_[index] : 0; }
+    void setCharAt(unsigned int index, char c) { if (index < s_.size()) s_[index] = c; }
+    char operator[](unsigned int index) const { return charAt(index); }
+    char& operator[](unsigned int index) { static char dummy; return index < s_.size() ? s_[index] : (dummy = 0); }
+
+    // search
+    int indexOf(char ch, unsigned int fromIndex = 0) const { return npos(s_.find(ch, fromIndex)); }
+    int indexOf(const String& str, unsigned int fromIndex = 0) const { return npos(s_.find(str.s_, fromIndex)); }
+    int lastIndexOf(char ch) const { return npos(s_.rfind(ch)); }
+    int lastIndexOf(char ch, unsigned int fromIndex) const { return npos(s_.rfind(ch, fromIndex)); }
+    int lastIndexOf(const String& str) const { return npos(s_.rfind(str.s_)); }
+    int lastIndexOf(const String& str, unsigned int fromIndex) const { return npos(s_.rfind(str.s_, fromIndex)); }
+    String substring(unsigned int beginIndex) const { return substring(beginIndex, length()); }
+    String substring(unsigned int left, unsigned int right) const {
+      if (left > right) { unsigned int t = left; left = right; right = t; }
+      if (left > s_.size()) return String();
+      if (right > s_.size()) right = (unsigned int)s_.size();
+      return String(s_.substr(left, right - left).c_str());
+    }
+
+    // modification
+    void replace(char find, char replace) { for (auto& c : s_) if (c == find) c = replace; }
+    void replace(const String& find, const String& replace) {
+      if (find.s_.empty()) return;
+      size_t pos = 0;
+      while ((pos = s_.find(find.s_, pos)) != std::string::npos) {
+        s_.replace(pos, find.s_.size(), replace.s_);
+        pos += replace.s_.size();
+      }
+    }
+    void remove(unsigned int index) { if (index < s_.size()) s_.erase(index); }
+    void remove(unsigned int index, unsigned int count) { if (index < s_.size()) s_.erase(index, count); }
+    void toLowerCase() { for (auto& c : s_) c = (char)tolower((unsigned char)c); }
+    void toUpperCase() { for (auto& c : s_) c = (char)toupper((unsigned char)c); }
+    void trim() {
+      size_t b = 0, e = s_.size();
+      while (b < e && isspace((unsigned char)s_[b])) b++;
+      while (e > b && isspace((unsigned char)s_[e - 1])) e--;
+      s_ = s_.substr(b, e - b);
+    }
+
+    // parsing
+    long toInt() const { return strtol(s_.c_str(), nullptr, 10); }
+    float toFloat() const { return strtof(s_.c_str(), nullptr); }
+    double toDouble() const { return strtod(s_.c_str(), nullptr); }
+
+  private:
+    std::string s_;
+
+    static int npos(size_t pos) { return pos == std::string::npos ? -1 : (int)pos; }
+    static std::string toBase(unsigned long long value, unsigned char base) {
+      if (base < 2) base = 10;
+      char buf[66];
+      char* p = buf + sizeof(buf) - 1;
+      *p = 0;
+      do {
+        unsigned d = (unsigned)(value % base);
+        *--p = (char)(d < 10 ? '0' + d : 'a' + d - 10);
+        value /= base;
+      } while (value);
+      return p;
+    }
+    static std::string toSignedBase(long long value, unsigned char base) {
+      if (value < 0 && base == 10) return "-" + toBase((unsigned long long)(-value), base);
+      return toBase((unsigned long long)value, base);
+    }
+    static std::string toFixed(double value, unsigned char decimalPlaces) {
+      char buf[64];
+      snprintf(buf, sizeof(buf), "%.*f", decimalPlaces, value);
+      return buf;
+    }
+};
+
+inline String operator+(const String& lhs, const String& rhs) { String r(lhs); r += rhs; return r; }
+inline String operator+(const String& lhs, const char* rhs) { String r(lhs); r += rhs; return r; }
+inline String operator+(const char* lhs, const String& rhs) { String r(lhs); r += rhs; return r; }
+inline String operator+(const String& lhs, char rhs) { String r(lhs); r += rhs; return r; }
+inline String operator+(const String& lhs, const __FlashStringHelper* rhs) { String r(lhs); r += rhs; return r; }
+inline String operator+(const String& lhs, int rhs) { String r(lhs); r += rhs; return r; }
+inline String operator+(const String& lhs, unsigned int rhs) { String r(lhs); r += rhs; return r; }
+inline String operator+(const String& lhs, long rhs) { String r(lhs); r += rhs; return r; }
+inline String operator+(const String& lhs, unsigned long rhs) { String r(lhs); r += rhs; return r; }
+inline bool operator==(const char* lhs, const String& rhs) { return rhs == lhs; }
+inline bool operator!=(const char* lhs, const String& rhs) { return rhs != lhs; }
+
+static const String emptyString;
@@ -0,0 +1,154 @@
+/*
+
+Host-side stand-in for the ESP8266 TwoWire master, wired to an I2CSDBridgeSim.
+
+Every transaction charges virtual time to sim::nowUs:
+
+  transactionUs + bytes * byteUs + (bytes * 9 + 2) bits / clock * sclStretchFactor + bridge stretch
+
+where bytes includes the address byte. transactionUs and byteUs cover the bit-banged master's
+software overhead; sclStretchFactor is the effective SCL period over the nominal one (the core
+cannot hold the requested clock and the bridge stretches every byte). With the defaults a 32-byte
+'R' chunk plus one small socket write takes about 9 ms at 100 kHz and 3.5 ms at 400 kHz, in line
+with the figures measured on hardware at the top of the sketch.
+
+Return codes follow the core: endTransmission() 0 = ok, 1 = data too long, 2 = address NACK;
+requestFrom() returns the number of bytes received, 0 on NACK.
+
+*/
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include "Arduino.h"
+#include "I2CSDBridgeSim.h"
+
+#ifndef BUFFER_LENGTH
+#define BUFFER_LENGTH 128
+#endif
+
+struct I2CBusTiming {
+  uint32_t transactionUs = 250;
+  double byteUs = 5.0;
+  double sclStretchFactor = 2.4;
+};
+
+struct I2CBusStats {
+  uint32_t transactions = 0;
+  uint32_t writeTransactions = 0;
+  uint32_t readTransactions = 0;
+  uint32_t nacks = 0;
+  uint64_t bytesWritten = 0;  // payload bytes, address bytes excluded
+  uint64_t bytesRead = 0;
+  uint64_t busUs = 0;         // virtual time spent on the bus, including clock stretching
+
+  void reset() { *this = I2CBusStats(); }
+};
+
+class TwoWire : public Stream {
+  public:
+    I2CBusTiming timing;
+    I2CBusStats stats;
+
+    void attach(I2CSDBridgeSim* device) { _device = device; }
+    I2CSDBridgeSim* device() const { return _device; }
+
+    void begin() {}
+    void begin(int, int) {}
+    void setClock(uint32_t frequency) { _clock = frequency ? frequency : 100000; }
+    uint32_t getClock() const { return _clock; }
+    void setClockStretchLimit(uint32_t) {}
+
+    void beginTransmission(uint8_t address) {
+      _txAddress = address;
+      _txLen = 0;
+      _txOverflow = false;
+    }
+    void beginTransmission(int address) { beginTransmission((uint8_t)address); }
+
+    uint8_t endTransmission(uint8_t sendStop) {
+      (void)sendStop;
+      size_t len = _txLen;
+      _txLen = 0;
+      stats.transactions++;
+      stats.writeTransactions++;
+      if (!addressDevice(_txAddress, len)) return 2;
+      stats.bytesWritten += len;
+      _device->receive(_txBuf, len);
+      chargeStretch();
+      if (_txOverflow) return 1;
+      return 0;
+    }
+    uint8_t endTransmission() { return endTransmission(true); }
+
+    uint8_t requestFrom(uint8_t address, size_t quantity, bool sendStop) {
+      (void)sendStop;
+      if (quantity > BUFFER_LENGTH) quantity = BUFFER_LENGTH;
+      _rxLen = _rxPos = 0;
+      stats.transactions++;
+      stats.readTransactions++;
+      if (!addressDevice(address, quantity)) return 0;
+      for (size_t i = 0; i < quantity; i++) _rxBuf[i] = _device->transmit();
+      _rxLen = quantity;
+      stats.bytesRead += quantity;
+      chargeStretch();
+      return (uint8_t)quantity;
+    }
+    uint8_t requestFrom(uint8_t address, uint8_t quantity) { return requestFrom(address, (size_t)quantity, true); }
+    uint8_t requestFrom(uint8_t address, uint8_t quantity, uint8_t sendStop) { return requestFrom(address, (size_t)quantity, sendStop != 0); }
+    uint8_t requestFrom(int address, int quantity) { return requestFrom((uint8_t)address, (size_t)quantity, true); }
+    uint8_t requestFrom(int address, int quantity, int sendStop) { return requestFrom((uint8_t)address, (size_t)quantity, sendStop != 0); }
+
+    size_t write(uint8_t data) override {
+      if (_txLen >= BUFFER_LENGTH) {
+        _txOverflow = true;
+        return 0;
+      }
+      _txBuf[_txLen++] = data;
+      return 1;
+    }
+    size_t write(const uint8_t* data, size_t quantity) override {
+      for (size_t i = 0; i < quantity; i++) {
+        if (!write(data[i])) return i;
+      }
+      return quantity;
+    }
+    using Print::write;
+
+    int available() override { return (int)(_rxLen - _rxPos); }
+    int read() override { return _rxPos < _rxLen ? _rxBuf[_rxPos++] : -1; }
+    int peek() override { return _rxPos < _rxLen ? _rxBuf[_rxPos] : -1; }
+    void flush() override {}
+
+  private:
+    I2CSDBridgeSim* _device = nullptr;
+    uint32_t _clock = 100000;
+    uint8_t _txAddress = 0;
+    uint8_t _txBuf[BUFFER_LENGTH];
+    size_t _txLen = 0;
+    bool _txOverflow = false;
+    uint8_t _rxBuf[BUFFER_LENGTH];
+    size_t _rxLen = 0;
+    size_t _rxPos = 0;
+
+    // Charges the time of an address byte plus payloadBytes, then returns whether the address was ACKed.
+    bool addressDevice(uint8_t address, size_t payloadBytes) {
+      if (_device) _device->setBusClock(_clock);
+      bool ack = _device && address == _device->address() && _device->ackAddress();
+      size_t bytes = 1 + (ack ? payloadBytes : 0);
+      double bitUs = 1e6 / (double)_clock * timing.sclStretchFactor;
+      uint64_t us = timing.transactionUs + (uint64_t)(bytes * timing.byteUs + (bytes * 9 + 2) * bitUs);
+      sim::advanceUs(us);
+      stats.busUs += us;
+      if (!ack) stats.nacks++;
+      return ack;
+    }
+
+    void chargeStretch() {
+      uint32_t us = _device->takeStretchUs();
+      sim::advanceUs(us);
+      stats.busUs += us;
+    }
+};
+
+inline TwoWire Wire;
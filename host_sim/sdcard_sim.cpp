@@ -0,0 +1,162 @@
+/*
+
+sdcard_sim - run the sketch on a workstation against a directory that stands in for the SD card.
+
+Build (from the repository root):
+  g++ -std=gnu++17 -O2 -Wall -I host_sim host_sim/sdcard_sim.cpp -o sdcard_sim
+
+Usage:
+  sdcard_sim CARD_DIR [options] [header 'NAME: VALUE']... [get URI | post URI ARGS | upload URI FILE | save URI FILE]...
+
+  --clock HZ            i2c_bus_Clock used outside downloads and listings
+  --list-clock HZ       i2c_bus_List
+  --download-clock HZ   i2c_bus_FileDownload
+                        (without any of the three the clocks are probed at start-up, as on the board;
+                        with one the others keep the sketch's defaults of 100000/200000/400000)
+  --quiet               do not echo the sketch's Serial output
+  --headers             print each response's headers to stdout
+  --body                print each response body to stdout
+  --nack-rate P         NACK a fraction P of I2C address phases
+  --bit-error-rate P    flip a bit in a fraction P of bytes read from the bridge
+  --max-clean-clock HZ  wiring that is only clean up to HZ: faster clocks NACK and flip bits (5% each)
+  --probe-drops-reply   bridge firmware that forgets a pending reply on an address-only probe
+
+header adds a request header to the next request, e.g. header 'Range: bytes=1000-'.
+upload posts the host file FILE as a multipart file upload, e.g. upload '/upload?DIR=/LOGS' build/app.bin.
+save gets URI and writes the response body to the host file FILE, e.g. save '/trace?format=bin' field.trace
+(see trace_replay.cpp).
+
+setup() runs first (bridge probe, card queries and RunSDCard_Demo, exactly as on the board), then
+each request is served through the sketch's routes. For every request the status, body size and
+virtual timing are printed. Times are simulated, so results are reproducible.
+
+*/
+#include "SimHeap.h"
+#include "SketchHost.h"
+
+#include <string>
+
+static void usage() {
+  fprintf(stderr, "usage: sdcard_sim CARD_DIR [--clock HZ] [--list-clock HZ] [--download-clock HZ] [--quiet] [--headers] [--body]\n"
+                  "                  [--nack-rate P] [--bit-error-rate P] [--max-clean-clock HZ] [--probe-drops-reply]\n"
+                  "                  [header 'NAME: VALUE']... [get URI | post URI ARGS | upload URI FILE | save URI FILE]...\n");
+}
+
+static void reportRequest(const char* method, const String& uri, SimConnection& conn, uint64_t startUs,
+                          const I2CBusStats& bus, size_t heapPeak, bool printHeaders, bool printBody,
+                          const std::string& saveTo) {
+  SimHttpResponse res = simParseResponse(conn);
+  uint64_t endUs = conn.drainedAtUs();
+  double totalMs = (endUs - startUs) / 1000.0;
+  double ttfbMs = conn.sent.empty() ? 0 : (conn.firstByteUs - startUs) / 1000.0;
+  double rate = totalMs > 0 ? res.body.size() / (totalMs / 1000.0) : 0;
+  fprintf(stderr, "%s %s -> %d, %zu body bytes, %.1f ms (TTFB %.1f ms), %.0f B/s, "
+                  "%u I2C transactions, %.1f ms on bus, %u socket writes, peak heap %zu\n",
+          method, uri.c_str(), res.status, res.body.size(), totalMs, ttfbMs, rate,
+          bus.transactions, bus.busUs / 1000.0, conn.writeCalls, heapPeak);
+  if (printHeaders) {
+    for (const auto& h : res.headers) printf("%s: %s\n", h.first.c_str(), h.second.c_str());
+    printf("\n");
+  }
+  if (printBody && !res.body.empty()) fwrite(res.body.data(), 1, res.body.size(), stdout);
+  if (!saveTo.empty()) {
+    FILE* f = fopen(saveTo.c_str(), "wb");
+    if (!f || fwrite(res.body.data(), 1, res.body.size(), f) != res.body.size()) fprintf(stderr, "cannot write %s\n", saveTo.c_str());
+    if (f) fclose(f);
+  }
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    usage();
+    return 2;
+  }
+  bool printHeaders = false;
+  bool printBody = false;
+  bool fixedClock = false;
+  I2CSDBridgeFaults faults;
+  int i = 2;
+  for (; i < argc; i++) {
+    std::string a = argv[i];
+    fixedClock |= a == "--clock" || a == "--list-clock" || a == "--download-clock";
+    if (a == "--clock" && i + 1 < argc) i2c_bus_Clock = strtoul(argv[++i], nullptr, 10);
+    else if (a == "--list-clock" && i + 1 < argc) i2c_bus_List = strtoul(argv[++i], nullptr, 10);
+    else if (a == "--download-clock" && i + 1 < argc) i2c_bus_FileDownload = strtoul(argv[++i], nullptr, 10);
+    else if (a == "--quiet") sim::serialEcho = false;
+    else if (a == "--headers") printHeaders = true;
+    else if (a == "--body") printBody = true;
+    else if (a == "--nack-rate" && i + 1 < argc) faults.nackRate = strtod(argv[++i], nullptr);
+    else if (a == "--bit-error-rate" && i + 1 < argc) faults.bitErrorRate = strtod(argv[++i], nullptr);
+    else if (a == "--max-clean-clock" && i + 1 < argc) faults.maxCleanClockHz = strtoul(argv[++i], nullptr, 10);
+    else if (a == "--probe-drops-reply") faults.probeDropsReply = true;
+    else if (a.rfind("--", 0) == 0) {
+      usage();
+      return 2;
+    } else break;
+  }
+  if (fixedClock) i2c_bus_AutoClock = false;
+
+  if (!sim::bridge.begin(argv[1])) {
+    fprintf(stderr, "cannot use %s as card directory\n", argv[1]);
+    return 1;
+  }
+  Wire.attach(&sim::bridge);
+  sim::bridge.faults.maxCleanClockHz = faults.maxCleanClockHz;  // the wiring is there from power-up
+  sim::bridge.faults.probeDropsReply = faults.probeDropsReply;  // and so is the bridge firmware
+  setup();
+  sim::bridge.setFaults(faults);
+
+  std::vector<std::pair<String, String>> headers;
+  for (; i < argc; i++) {
+    std::string cmd = argv[i];
+    if (cmd == "header" && i + 1 < argc) {
+      std::string h = argv[++i];
+      size_t colon = h.find(':');
+      if (colon == std::string::npos) {
+        usage();
+        return 2;
+      }
+      String value = h.substr(colon + 1).c_str();
+      value.trim();
+      headers.push_back({ String(h.substr(0, colon).c_str()), value });
+    } else if ((cmd == "get" || cmd == "post" || ((cmd == "upload" || cmd == "save") && i + 2 < argc)) && i + 1 < argc) {
+      SimHttpRequest req;
+      req.uri = argv[++i];
+      std::string saveTo;
+      if (cmd == "save") saveTo = argv[++i];
+      req.headers = std::move(headers);
+      headers.clear();
+      if (cmd == "upload") {
+        std::filesystem::path file = argv[++i];
+        FILE* f = fopen(file.string().c_str(), "rb");
+        if (!f) {
+          fprintf(stderr, "cannot read %s\n", file.string().c_str());
+          return 1;
+        }
+        sim::Untracked untracked;
+        uint8_t buf[4096];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), f)) > 0) req.body.insert(req.body.end(), buf, buf + n);
+        fclose(f);
+        req.method = HTTP_POST;
+        req.uploadFilename = file.filename().string().c_str();
+      } else if (cmd == "post") {
+        req.method = HTTP_POST;
+        if (i + 1 < argc) {
+          std::string body = argv[++i];
+          req.body.assign(body.begin(), body.end());
+        }
+      }
+      Wire.stats.reset();
+      sim::resetHeapPeak();
+      uint64_t startUs = sim::nowUs;
+      auto conn = server.simRequest(req);
+      sim::runLoopUntilClosed(*conn);
+      reportRequest(req.method == HTTP_POST ? "POST" : "GET", req.uri, *conn, startUs, Wire.stats, sim::heapPeak, printHeaders, printBody, saveTo);
+    } else {
+      usage();
+      return 2;
+    }
+  }
+  return 0;
+}
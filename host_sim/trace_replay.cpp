@@ -0,0 +1,268 @@
+/*
+
+trace_replay - replay an I2C transaction trace dumped by the sketch (GET /trace?format=bin) against the
+simulated bridge, to reproduce field timing offline and compare it with the simulator's bus model.
+
+Build (from the repository root):
+  g++ -std=gnu++17 -O2 -Wall -I host_sim host_sim/trace_replay.cpp -o trace_replay
+
+Usage:
+  trace_replay TRACE_FILE [options]
+
+  --card DIR            card directory to replay against (default: a fresh temporary one)
+  --verbose             print every transaction: field and simulated duration and result
+  --nack-rate P         NACK a fraction P of I2C address phases
+  --bit-error-rate P    flip a bit in a fraction P of bytes read from the bridge
+  --max-clean-clock HZ  wiring that is only clean up to HZ: faster clocks NACK and flip bits (5% each)
+
+Every transaction is issued at the clock it ran at in the field, with the same address, command, length and
+STOP. The gaps between transactions (the sketch's own work and the network) are kept: a transaction starts no
+earlier than it did in the field, relative to the first one. The trace only keeps four bytes of payload, so the
+paths of 'F'/'I' are rebuilt from their first four characters padded to the recorded length, and stand-in files
+(sparse, large enough for every 'O'/'G' offset) or directories are created for them; writes send zeros.
+
+The summary lists, per command, the field and simulated bus time and the transactions whose result differed
+(a NACK or short read in the field the simulator did not see, or the other way round), plus the end-to-end time
+of the whole trace in both.
+
+*/
+#include "Arduino.h"
+#include "Wire.h"
+
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+struct TraceRecord {
+  uint32_t us;
+  uint16_t durationUs;
+  uint16_t clockKHz;
+  uint8_t address;
+  uint8_t flags;
+  uint8_t command;
+  uint8_t length;
+  uint8_t result;
+  uint8_t data[4];
+};
+
+const uint8_t kRead = 0x01, kStop = 0x02, kError = 0x04;  // SD_TRACE_READ, SD_TRACE_STOP, SD_TRACE_ERROR
+
+struct CommandStats {
+  uint32_t count = 0;
+  uint64_t fieldUs = 0;
+  uint64_t simUs = 0;
+  uint32_t mismatches = 0;
+  uint32_t fieldErrors = 0;  // records the sketch flagged with sdClockError()
+};
+
+static void usage() {
+  fprintf(stderr, "usage: trace_replay TRACE_FILE [--card DIR] [--verbose] [--nack-rate P] [--bit-error-rate P] [--max-clean-clock HZ]\n");
+}
+
+static uint32_t le32(const uint8_t* b) { return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24); }
+static uint16_t le16(const uint8_t* b) { return b[0] | (b[1] << 8); }
+
+static bool loadTrace(const char* file, std::vector<TraceRecord>& records, uint32_t& total) {
+  std::ifstream in(file, std::ios::binary);
+  std::vector<uint8_t> raw((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  if (raw.size() < 16 || std::string(raw.begin(), raw.begin() + 4) != "SDTR" || raw[4] != 1) {
+    fprintf(stderr, "%s is not a version 1 trace (GET /trace?format=bin)\n", file);
+    return false;
+  }
+  size_t recordBytes = raw[5];
+  size_t count = le16(&raw[6]);
+  total = le32(&raw[8]);
+  if (recordBytes < 17 || raw.size() < 16 + count * recordBytes) {
+    fprintf(stderr, "%s is truncated\n", file);
+    return false;
+  }
+  for (size_t i = 0; i < count; i++) {
+    const uint8_t* b = &raw[16 + i * recordBytes];
+    TraceRecord r;
+    r.us = le32(b);
+    r.durationUs = le16(b + 4);
+    r.clockKHz = le16(b + 6);
+    r.address = b[8];
+    r.flags = b[9];
+    r.command = b[10];
+    r.length = b[11];
+    r.result = b[12];
+    memcpy(r.data, b + 13, 4);
+    records.push_back(r);
+  }
+  return true;
+}
+
+static bool isPathCommand(const TraceRecord& r) {
+  return !(r.flags & kRead) && (r.command == 'F' || r.command == 'I') && r.length >= 2;
+}
+
+// The path a 'F'/'I' record stands for: its first (up to) four characters, padded to the recorded length
+static std::string standInPath(const TraceRecord& r) {
+  std::string path;
+  for (size_t i = 0; i < 4 && i + 1 < r.length && r.data[i] >= 0x20 && r.data[i] < 0x7F; i++) path += (char)r.data[i];
+  if (path.empty() || path[0] != '/') path = "/" + path.substr(0, 3);
+  while (path.size() + 1 < r.length) path += 'X';
+  return path;
+}
+
+// A path selected for 'L', 'N', 'K', 'M' or 'D' (or an 'I' whose reply said so) becomes a directory, anything else a file
+static bool wantsDirectory(const std::vector<TraceRecord>& records, size_t i) {
+  const TraceRecord& r = records[i];
+  if (r.command == 'I' && i + 1 < records.size() && (records[i + 1].flags & kRead)) return records[i + 1].data[0] == 0x02;
+  for (size_t j = i + 1; j < records.size(); j++) {
+    const TraceRecord& next = records[j];
+    if ((next.flags & kRead) || next.length == 0) continue;
+    return next.command == 'L' || next.command == 'N' || next.command == 'K' || next.command == 'M' || next.command == 'D';
+  }
+  return false;
+}
+
+static void makeStandIn(const std::filesystem::path& root, const std::string& path, bool directory, uint64_t fileSize) {
+  std::error_code ec;
+  std::filesystem::path host = root / path.substr(1);
+  if (directory) {
+    if (std::filesystem::is_directory(host, ec)) return;
+    std::filesystem::remove(host, ec);
+    std::filesystem::create_directories(host, ec);
+    for (int n = 0; n < 16; n++) {
+      char name[16];
+      snprintf(name, sizeof(name), "FILE%02d.TXT", n);
+      std::ofstream(host / name) << "replay\n";
+    }
+    return;
+  }
+  if (std::filesystem::is_regular_file(host, ec) && std::filesystem::file_size(host, ec) >= fileSize) return;
+  std::filesystem::remove_all(host, ec);
+  std::filesystem::create_directories(host.parent_path(), ec);
+  std::ofstream(host, std::ios::binary | std::ios::app).close();
+  std::filesystem::resize_file(host, fileSize, ec);
+}
+
+static std::string commandName(uint8_t command) {
+  if (command == 0) return "(probe/stop)";
+  if (command >= 0x20 && command < 0x7F) return std::string(1, (char)command);
+  char buf[8];
+  snprintf(buf, sizeof(buf), "0x%02x", command);
+  return buf;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    usage();
+    return 2;
+  }
+  std::string cardDir;
+  bool verbose = false;
+  I2CSDBridgeFaults faults;
+  for (int i = 2; i < argc; i++) {
+    std::string a = argv[i];
+    if (a == "--card" && i + 1 < argc) cardDir = argv[++i];
+    else if (a == "--verbose") verbose = true;
+    else if (a == "--nack-rate" && i + 1 < argc) faults.nackRate = strtod(argv[++i], nullptr);
+    else if (a == "--bit-error-rate" && i + 1 < argc) faults.bitErrorRate = strtod(argv[++i], nullptr);
+    else if (a == "--max-clean-clock" && i + 1 < argc) faults.maxCleanClockHz = strtoul(argv[++i], nullptr, 10);
+    else {
+      usage();
+      return 2;
+    }
+  }
+
+  std::vector<TraceRecord> records;
+  uint32_t total = 0;
+  if (!loadTrace(argv[1], records, total)) return 1;
+  if (records.empty()) {
+    fprintf(stderr, "the trace is empty\n");
+    return 1;
+  }
+
+  if (cardDir.empty()) {
+    char tmpl[] = "/tmp/trace_replayXXXXXX";
+    if (!mkdtemp(tmpl)) {
+      fprintf(stderr, "cannot create a temporary card directory\n");
+      return 1;
+    }
+    cardDir = tmpl;
+  }
+  I2CSDBridgeSim bridge(records[0].address);
+  if (!bridge.begin(cardDir)) {
+    fprintf(stderr, "cannot use %s as card directory\n", cardDir.c_str());
+    return 1;
+  }
+  bridge.setFaults(faults);
+  Wire.attach(&bridge);
+
+  uint64_t fileSize = 1 << 20;
+  for (const TraceRecord& r : records) {
+    if (!(r.flags & kRead) && (r.command == 'O' || r.command == 'G') && r.length >= 5) {
+      uint64_t offset = ((uint32_t)r.data[0] << 24) | (r.data[1] << 16) | (r.data[2] << 8) | r.data[3];
+      if (offset + 65536 > fileSize) fileSize = offset + 65536;
+    }
+  }
+
+  printf("%zu of %u traced transactions, card %s\n", records.size(), total, cardDir.c_str());
+  std::map<uint8_t, CommandStats> stats;
+  uint64_t simStart = sim::nowUs;
+  for (size_t i = 0; i < records.size(); i++) {
+    const TraceRecord& r = records[i];
+    uint64_t due = simStart + (uint32_t)(r.us - records[0].us);
+    if (sim::nowUs < due) sim::advanceUs(due - sim::nowUs);
+    Wire.setClock(r.clockKHz * 1000u);
+
+    uint64_t started = sim::nowUs;
+    int result;
+    if (r.flags & kRead) {
+      result = Wire.requestFrom((int)r.address, (int)r.length, (r.flags & kStop) ? 1 : 0);
+      while (Wire.available()) Wire.read();
+    } else {
+      Wire.beginTransmission(r.address);
+      if (r.length > 0) {
+        if (isPathCommand(r)) {
+          std::string path = standInPath(r);
+          makeStandIn(bridge.root(), path, wantsDirectory(records, i), fileSize);
+          Wire.write(r.command);
+          Wire.write((const uint8_t*)path.data(), path.size());
+        } else {
+          Wire.write(r.command);
+          for (size_t n = 1; n < r.length; n++) Wire.write(n <= 4 ? r.data[n - 1] : 0);
+        }
+      }
+      result = Wire.endTransmission((r.flags & kStop) ? 1 : 0);
+    }
+    uint32_t simUs = sim::nowUs - started;
+
+    CommandStats& s = stats[r.command];  // a read counts under the command it answers
+    s.count++;
+    s.fieldUs += r.durationUs;
+    s.simUs += simUs;
+    if (result != r.result) s.mismatches++;
+    if (r.flags & kError) s.fieldErrors++;
+    if (verbose) {
+      printf("%10u %c %-12s len %3u clock %4u kHz  field %6u us result %3u%s  sim %6u us result %3d%s\n",
+             r.us - records[0].us, (r.flags & kRead) ? 'R' : 'W', commandName(r.command).c_str(), r.length, r.clockKHz,
+             r.durationUs, r.result, (r.flags & kError) ? " E" : "  ", simUs, result, result != r.result ? " *" : "");
+    }
+  }
+
+  const TraceRecord& last = records.back();
+  uint64_t fieldSpan = (uint32_t)(last.us - records[0].us) + last.durationUs;
+  uint64_t simSpan = sim::nowUs - simStart;
+  printf("\n%-12s %7s %12s %12s %8s %10s %12s\n", "command", "count", "field_ms", "sim_ms", "sim/fld", "mismatch", "field_errors");
+  CommandStats sum;
+  for (const auto& entry : stats) {
+    const CommandStats& s = entry.second;
+    printf("%-12s %7u %12.1f %12.1f %8.2f %10u %12u\n", commandName(entry.first).c_str(), s.count, s.fieldUs / 1000.0,
+           s.simUs / 1000.0, s.fieldUs ? (double)s.simUs / s.fieldUs : 0.0, s.mismatches, s.fieldErrors);
+    sum.count += s.count;
+    sum.fieldUs += s.fieldUs;
+    sum.simUs += s.simUs;
+    sum.mismatches += s.mismatches;
+    sum.fieldErrors += s.fieldErrors;
+  }
+  printf("%-12s %7u %12.1f %12.1f %8.2f %10u %12u\n", "all", sum.count, sum.fieldUs / 1000.0, sum.simUs / 1000.0,
+         sum.fieldUs ? (double)sum.simUs / sum.fieldUs : 0.0, sum.mismatches, sum.fieldErrors);
+  printf("\nend to end: field %.1f ms, replay %.1f ms\n", fieldSpan / 1000.0, simSpan / 1000.0);
+  return 0;
+}